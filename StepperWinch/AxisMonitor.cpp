@@ -0,0 +1,192 @@
+/// \file AxisMonitor.cpp
+/// \brief Step-loss detection for a single stepper channel.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#include "AxisMonitor.h"
+
+// Switch changes within this many microseconds of the previous accepted edge
+// are treated as contact bounce; the level is sampled again afterward.
+#define DEBOUNCE_USEC 2000
+
+// Quadrature decoding table indexed by (previous state << 2) | new state.
+// Invalid transitions (both channels changing) count as zero.  The table is
+// kept in flash.
+static const int8_t quadrature_delta[16] PROGMEM = {
+  0, -1,  1,  0,
+  1,  0,  0, -1,
+ -1,  0,  0,  1,
+  0,  1, -1,  0
+};
+
+//================================================================
+AxisMonitor::AxisMonitor(Stepper *_stepper, uint8_t _limit_pin)
+{
+  stepper   = _stepper;
+  limit_pin = _limit_pin;
+  correct   = 0;
+  tolerance = 0;
+
+  encoder_num    = 1;
+  encoder_den    = 0;
+  encoder_offset = 0;
+  encoder_tolerance = 1;
+
+  limit_level    = 1;
+  limit_deferred = 0;
+  last_edge      = 0;
+  index_known    = 0;
+  index_position[0] = index_position[1] = 0;
+  latched        = 0;
+  latch_position = 0;
+  lost_steps     = 0;
+  encoder_count  = 0;
+  encoder_state  = 0;
+}
+
+//================================================================
+// Switch edge processing running in interrupt context.
+void AxisMonitor::pollLimit(void)
+{
+  if (limit_pin == NO_PIN) return;
+
+  uint8_t level = digitalRead(limit_pin);
+  if (level == limit_level) {
+    limit_deferred = 0;
+    return;
+  }
+
+  // A change too soon after the last accepted edge may be contact bounce, but
+  // it may also be the last edge for some time, so rather than being dropped
+  // it is sampled again by pollDeferred() once the interval has passed.
+  unsigned long now = micros();
+  if (now - last_edge < DEBOUNCE_USEC) {
+    limit_deferred = 1;
+    return;
+  }
+  limit_deferred = 0;
+  last_edge = now;
+  limit_level = level;
+
+  // Only the closing edge of the active-low switch is used as the index.
+  if (level != 0) return;
+
+  long position = stepper->currentPosition();
+  latch_position = position;
+  latched = 1;
+
+  // The switch trips at slightly different positions from each side, so the
+  // index is learned separately for each direction of approach.
+  uint8_t dir = (stepper->lastDirection() > 0) ? 1 : 0;
+
+  if (!correct) return;
+
+  if (index_known & (1 << dir)) {
+    long error = position - index_position[dir];
+    if (abs(error) > tolerance) {
+      stepper->adjustPosition(-error);
+      lost_steps += error;
+    }
+  } else {
+    index_position[dir] = position;
+    index_known |= (1 << dir);
+  }
+}
+
+//================================================================
+// Quadrature counting running in interrupt context.
+void AxisMonitor::updateEncoder(uint8_t a, uint8_t b)
+{
+  uint8_t state = ((a != 0) << 1) | (b != 0);
+  encoder_count += (int8_t) pgm_read_byte(&quadrature_delta[(encoder_state << 2) | state]);
+  encoder_state = state;
+}
+
+//================================================================
+long AxisMonitor::poll(void)
+{
+  if (correct && encoder_den != 0) {
+    noInterrupts();
+    long counts   = encoder_count;
+    long position = stepper->currentPosition();
+    interrupts();
+
+    // The product can exceed 32 bits after a long run at a fine scale.
+    long error = position - (encoder_offset + (long) (((int64_t) counts * encoder_num) / encoder_den));
+    if (abs(error) > encoder_tolerance) {
+      noInterrupts();
+      stepper->adjustPosition(-error);
+      lost_steps += error;
+      interrupts();
+    }
+  }
+
+  noInterrupts();
+  long lost = lost_steps;
+  lost_steps = 0;
+  interrupts();
+  return lost;
+}
+
+//================================================================
+void AxisMonitor::setCorrection(bool enable, long _tolerance)
+{
+  correct = enable;
+  tolerance = (_tolerance < 0) ? 0 : _tolerance;
+  if (!enable) index_known = 0;
+}
+
+//================================================================
+void AxisMonitor::setEncoderScale(long num, long den, long _tolerance)
+{
+  if (_tolerance < 0) _tolerance = (den == 0) ? 1 : max(1L, (labs(num) + labs(den) - 1) / labs(den));
+
+  noInterrupts();
+  encoder_tolerance = _tolerance;
+  encoder_num    = num;
+  encoder_den    = den;
+  encoder_count  = 0;
+  encoder_offset = stepper->currentPosition();
+  interrupts();
+}
+
+//================================================================
+void AxisMonitor::offsetPosition(long delta)
+{
+  noInterrupts();
+  encoder_offset    += delta;
+  index_position[0] += delta;
+  index_position[1] += delta;
+  latch_position    += delta;
+  interrupts();
+}
+
+//================================================================
+void AxisMonitor::setIndex(int8_t direction, long position)
+{
+  uint8_t dir = (direction > 0) ? 1 : 0;
+  noInterrupts();
+  index_position[dir] = position;
+  index_known = (1 << dir);
+  interrupts();
+}
+
+//================================================================
+bool AxisMonitor::readLatch(long *position)
+{
+  noInterrupts();
+  bool valid = latched;
+  *position = latch_position;
+  latched = 0;
+  interrupts();
+  return valid;
+}
+//================================================================
@@ -0,0 +1,124 @@
+/// \file AxisMonitor.h
+/// \brief Step-loss detection for a single stepper channel.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details This class closes the loop around an open-loop Stepper using two
+/// optional sources of position feedback.  An active-low limit or index
+/// switch latches the step count on each closing edge; once the switch
+/// position has been learned, any later disagreement is counted as lost steps
+/// and corrected.  A quadrature encoder can also be counted, in which case the
+/// scaled encoder position is compared against the step count on every poll.
+///
+/// The input handlers are designed to be called from pin-change interrupts so
+/// that the latched position is exact.  The polling function runs from the
+/// main event loop and reports corrections.
+
+#ifndef __AXISMONITOR_H_INCLUDED__
+#define __AXISMONITOR_H_INCLUDED__
+
+#include <stdint.h>
+#include "Stepper.h"
+
+/// Pin value indicating that an input is not connected.
+#define NO_PIN 0xff
+
+// ================================================================
+class AxisMonitor {
+
+private:
+  /****************************************************************/
+  // The following instance variables may only be modified from a non-interrupt
+  // context, i.e., not within the input handlers.
+
+  Stepper *stepper;           ///< step generator whose position is monitored and corrected
+  uint8_t limit_pin;          ///< active-low switch input, or NO_PIN
+  uint8_t correct;            ///< true if detected errors are corrected
+  long tolerance;             ///< index errors within this many steps are ignored
+  long encoder_tolerance;     ///< encoder errors within this many steps are ignored
+  long encoder_num;           ///< encoder scale numerator: steps = counts * num / den
+  long encoder_den;           ///< encoder scale denominator, or zero if no encoder is used
+  long encoder_offset;        ///< step position corresponding to zero encoder counts
+
+  /****************************************************************/
+  // The following instance variables may be modified by the input handlers
+  // from an interrupt context.
+
+  volatile uint8_t limit_level;       ///< most recently accepted switch level
+  volatile uint8_t limit_deferred;    ///< true if a change arrived within the debounce interval
+  volatile unsigned long last_edge;   ///< micros() time of the last accepted edge
+  volatile uint8_t index_known;       ///< bit 0: index learned moving down, bit 1: moving up
+  long index_position[2];             ///< step count at the switch closing edge, for each approach direction
+  volatile uint8_t latched;           ///< true when latch_position holds an unread edge position
+  volatile long latch_position;       ///< step count at the most recent closing edge
+  volatile long lost_steps;           ///< error corrected at the most recent check, not yet reported
+  volatile long encoder_count;        ///< accumulated quadrature counts
+  volatile uint8_t encoder_state;     ///< previous two-bit quadrature state
+
+public:
+
+  /// Main constructor.  The arguments are the step generator to monitor and the
+  /// limit switch input pin, or NO_PIN.  Note: this does not initialize the
+  /// underlying hardware.
+  AxisMonitor(Stepper *stepper, uint8_t limit_pin);
+
+  /// Return the limit switch pin, or NO_PIN.
+  uint8_t limitPin(void) { return limit_pin; }
+
+  /// Switch input handler, typically called from a pin-change interrupt.
+  /// Samples the switch and processes any edge.
+  void pollLimit(void);
+
+  /// Periodic handler for use with pin-change interrupts, called from the
+  /// step interrupt.  Samples the switch again if a change arrived within the
+  /// debounce interval of the previous edge, so a genuine edge following
+  /// bounce is accepted once the interval has passed.
+  void pollDeferred(void) { if (limit_deferred) pollLimit(); }
+
+  /// Encoder input handler, called from a pin-change interrupt with the
+  /// current levels of the A and B channels.
+  void updateEncoder(uint8_t a, uint8_t b);
+
+  /// Polling function to be called from the main event loop to check the
+  /// encoder.  Returns the signed number of steps corrected since the last
+  /// call, which is zero in normal operation.
+  long poll(void);
+
+  /// Enable or disable correction.  Index errors no larger than the tolerance
+  /// in steps are ignored.  Disabling correction also forgets the learned index.
+  /// The encoder check has its own tolerance, set with setEncoderScale().
+  void setCorrection(bool enable, long tolerance);
+
+  /// Configure the encoder scaling as a ratio of steps per count, and zero the
+  /// encoder at the current step position.  A zero denominator disables the
+  /// encoder check.  Errors no larger than the tolerance in steps are ignored;
+  /// a negative tolerance selects the default of one count rounded up to whole
+  /// steps, since the scaled encoder position can be off by that much.
+  void setEncoderScale(long num, long den, long tolerance = -1);
+
+  /// Shift the monitored coordinates by the given number of steps, to follow a
+  /// Stepper::offsetPosition() of the same amount, e.g. when homing.  The
+  /// encoder zero and any learned switch positions move with the step count.
+  void offsetPosition(long delta);
+
+  /// Forget any learned switch position.
+  void clearIndex(void) { index_known = 0; }
+
+  /// Set the switch position for the given direction of approach, e.g. after
+  /// homing.  Other learned positions are forgotten.
+  void setIndex(int8_t direction, long position);
+
+  /// Fetch and clear the most recent latched switch position.  Returns false
+  /// if no edge has occurred since the last call.
+  bool readLatch(long *position);
+
+  /// Return true if the limit switch is currently closed.
+  bool limitActive(void) { return limit_pin != NO_PIN && limit_level == 0; }
+};
+
+#endif //__AXISMONITOR_H_INCLUDED__
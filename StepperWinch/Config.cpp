@@ -0,0 +1,79 @@
+/// \file Config.cpp
+/// \brief Persistent winch configuration stored in EEPROM.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <stdint.h>
+
+#include "Config.h"
+
+// Header bytes: magic, version and payload size (16 bits).
+#define CONFIG_HEADER 4
+
+// The record must fit below the gesture library.
+static_assert(CONFIG_HEADER + sizeof(WinchConfig) + 2 <= CONFIG_SPACE, "configuration record too large");
+
+//================================================================
+/// Update a CRC-16 with the CCITT polynomial 0x1021 by one byte.
+static uint16_t crc16_update(uint16_t crc, uint8_t data)
+{
+  crc ^= (uint16_t) data << 8;
+  for (uint8_t i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+  return crc;
+}
+
+//================================================================
+bool config_load(WinchConfig *config)
+{
+  uint8_t header[CONFIG_HEADER] = { CONFIG_MAGIC, CONFIG_VERSION, sizeof(WinchConfig) & 0xff, sizeof(WinchConfig) >> 8 };
+  uint16_t crc = 0xffff;
+  int address = CONFIG_BASE;
+
+  for (uint8_t i = 0; i < CONFIG_HEADER; i++, address++) {
+    uint8_t value = EEPROM.read(address);
+    if (value != header[i]) return false;
+    crc = crc16_update(crc, value);
+  }
+
+  // Check the whole payload before any of it is used.
+  for (unsigned int i = 0; i < sizeof(WinchConfig); i++) crc = crc16_update(crc, EEPROM.read(address + i));
+  if (crc != (EEPROM.read(address + sizeof(WinchConfig)) | ((uint16_t) EEPROM.read(address + sizeof(WinchConfig) + 1) << 8)))
+    return false;
+
+  uint8_t *dest = (uint8_t *) config;
+  for (unsigned int i = 0; i < sizeof(WinchConfig); i++) dest[i] = EEPROM.read(address + i);
+  return true;
+}
+
+//================================================================
+void config_save(const WinchConfig *config)
+{
+  uint8_t header[CONFIG_HEADER] = { CONFIG_MAGIC, CONFIG_VERSION, sizeof(WinchConfig) & 0xff, sizeof(WinchConfig) >> 8 };
+  const uint8_t *src = (const uint8_t *) config;
+  uint16_t crc = 0xffff;
+  int address = CONFIG_BASE;
+
+  for (uint8_t i = 0; i < CONFIG_HEADER; i++, address++) {
+    EEPROM.update(address, header[i]);
+    crc = crc16_update(crc, header[i]);
+  }
+  for (unsigned int i = 0; i < sizeof(WinchConfig); i++, address++) {
+    EEPROM.update(address, src[i]);
+    crc = crc16_update(crc, src[i]);
+  }
+  EEPROM.update(address, crc & 0xff);
+  EEPROM.update(address + 1, crc >> 8);
+}
+
+//================================================================
+void config_clear(void)
+{
+  EEPROM.update(CONFIG_BASE, (uint8_t) ~CONFIG_MAGIC);
+}
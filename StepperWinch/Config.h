@@ -0,0 +1,68 @@
+/// \file Config.h
+/// \brief Persistent winch configuration stored in EEPROM.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details The settings which a host would otherwise resend after every
+/// reset are kept in one record at the start of EEPROM: a magic byte, a
+/// layout version, the payload size, the payload itself as stored in RAM,
+/// and a CRC-16 (CCITT polynomial) over all of the preceding bytes.  A record
+/// is only accepted if every field matches, so a blank EEPROM, a record from
+/// an older layout, or one interrupted while being written all read as
+/// absent and the compiled-in defaults stay in effect.  Reading the record
+/// takes well under a millisecond; writing it blocks for about 3.3 msec per
+/// changed byte.  Change CONFIG_VERSION whenever WinchConfig changes.
+
+#ifndef __CONFIG_H_INCLUDED__
+#define __CONFIG_H_INCLUDED__
+
+#include <stdint.h>
+
+/// EEPROM address of the configuration record.
+#define CONFIG_BASE 0
+
+/// Bytes reserved for the configuration record, below the gesture library.
+#define CONFIG_SPACE 160
+
+/// First byte of a valid record.
+#define CONFIG_MAGIC 0x57
+
+/// Layout version of WinchConfig.
+#define CONFIG_VERSION 3
+
+/// Number of channels with saved settings.
+#define CONFIG_AXES 4
+
+/// Saved settings of one channel's path generator.
+struct AxisConfig {
+  float k;                  ///< proportional gain, in 1/sec^2
+  float b;                  ///< derivative gain, in 1/sec
+  float qd_max;             ///< velocity limit in steps/sec
+  float qdd_max;            ///< acceleration limit in steps/sec/sec
+  int32_t speed;            ///< ramp speed in steps/sec, or zero if unlimited
+};
+
+/// Saved settings of the whole winch.
+struct WinchConfig {
+  AxisConfig axes[CONFIG_AXES];        ///< channel settings, in channel order
+  uint32_t status_interval;            ///< status report interval in microseconds
+  uint32_t driver_idle_time;           ///< quiet time in microseconds before driver power is reduced, or zero
+  uint8_t driver_hold_level;           ///< reduced holding current as a PWM level, or zero to switch off
+};
+
+/// Read the saved configuration.  Returns false and leaves the argument
+/// unchanged if no valid record is stored.
+bool config_load(WinchConfig *config);
+
+/// Write a configuration record, skipping bytes which are unchanged.
+void config_save(const WinchConfig *config);
+
+/// Invalidate the saved record so that the defaults apply after a reset.
+void config_clear(void);
+
+#endif //__CONFIG_H_INCLUDED__
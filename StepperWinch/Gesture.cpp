@@ -0,0 +1,287 @@
+/// \file Gesture.cpp
+/// \brief Library of numbered spline gestures stored in EEPROM.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <stdint.h>
+
+#include "Gesture.h"
+
+static_assert(CONFIG_BASE + CONFIG_SPACE <= GESTURE_BASE, "configuration record overlaps the gesture list");
+
+//================================================================
+// Little-endian EEPROM access.  EEPROM.update() skips bytes which already
+// hold the value, which saves both time and wear.
+
+static uint16_t read_word(int address)
+{
+  return EEPROM.read(address) | ((uint16_t) EEPROM.read(address + 1) << 8);
+}
+
+static void write_word(int address, uint16_t value)
+{
+  EEPROM.update(address, value & 0xff);
+  EEPROM.update(address + 1, value >> 8);
+}
+
+static long read_long(int address)
+{
+  return read_word(address) | ((uint32_t) read_word(address + 2) << 16);
+}
+
+static void write_long(int address, long value)
+{
+  write_word(address, value & 0xffff);
+  write_word(address + 2, (uint32_t) value >> 16);
+}
+
+//================================================================
+GestureLibrary::GestureLibrary()
+{
+  storing = false;
+  store_id = 0;
+  store_channels = 0;
+  store_start = store_address = GESTURE_FIRST;
+  store_count = 0;
+  playing = false;
+  play_channels = 0;
+  play_address = GESTURE_FIRST;
+  play_index = play_count = 0;
+}
+
+//================================================================
+bool GestureLibrary::hasHeader(void)
+{
+  return EEPROM.read(GESTURE_BASE) == GESTURE_MAGIC && EEPROM.read(GESTURE_BASE + 1) == GESTURE_VERSION;
+}
+
+//================================================================
+int GestureLibrary::nextRecord(int address)
+{
+  int length = EEPROM.length();
+  if (address + GESTURE_HEADER > length || EEPROM.read(address) == GESTURE_END) return -1;
+
+  uint8_t channels = EEPROM.read(address + 1);
+  unsigned int points = read_word(address + 4);
+  if (channels == 0 || channels > GESTURE_CHANNELS || points == 0 || points == GESTURE_UNFINISHED) return -1;
+
+  // A complete record is always followed by at least the end marker.
+  long next = address + GESTURE_HEADER + (long) channels * (4 + 2 * (long) (points - 1));
+  return (next < length) ? (int) next : -1;
+}
+
+//================================================================
+int GestureLibrary::find(uint8_t id)
+{
+  if (!hasHeader()) return -1;
+  for (int address = GESTURE_FIRST, next; (next = nextRecord(address)) >= 0; address = next) {
+    if (EEPROM.read(address) == id) return address;
+  }
+  return -1;
+}
+
+//================================================================
+int GestureLibrary::freeAddress(void)
+{
+  int tail = GESTURE_FIRST;
+  if (!hasHeader()) return tail;
+  for (int address = GESTURE_FIRST, next; (next = nextRecord(address)) >= 0; address = next) {
+    if (EEPROM.read(address) != GESTURE_DELETED) tail = next;
+  }
+  return tail;
+}
+
+//================================================================
+int GestureLibrary::freeSpace(void)
+{
+  // Leave room for the end marker.
+  return max(0, (int) EEPROM.length() - 1 - freeAddress());
+}
+
+//================================================================
+bool GestureLibrary::beginStore(uint8_t id, uint8_t channels, unsigned int segment_ms)
+{
+  if (id > GESTURE_MAX_ID || channels == 0 || channels > GESTURE_CHANNELS || segment_ms == 0) return false;
+
+  // Abandon any open record and any playback reading the old gesture.
+  if (storing) EEPROM.update(store_start, GESTURE_END);
+  storing = false;
+  playing = false;
+  erase(id);
+  if (!hasHeader()) eraseAll();
+
+  int start = freeAddress();
+  if (start + GESTURE_HEADER + 4 * channels >= (int) EEPROM.length()) return false;
+
+  // The id is written last so that an interrupted header still reads as the end of the list.
+  EEPROM.update(start + 1, channels);
+  write_word(start + 2, segment_ms);
+  write_word(start + 4, GESTURE_UNFINISHED);
+  EEPROM.update(start, GESTURE_DELETED);
+
+  store_id = id;
+  store_channels = channels;
+  store_start = start;
+  store_address = start + GESTURE_HEADER;
+  store_count = 0;
+  storing = true;
+  return true;
+}
+
+//================================================================
+bool GestureLibrary::storePoint(const long *values)
+{
+  if (!storing || store_count == GESTURE_UNFINISHED - 1) return false;
+
+  // The first point of each channel is stored in full, later ones as differences.
+  int size = (store_count == 0) ? 4 : 2;
+  if (store_address + size * store_channels >= (int) EEPROM.length()) return false;
+  if (store_count > 0) {
+    for (uint8_t i = 0; i < store_channels; i++) {
+      if (abs(values[i] - store_last[i]) > SPLINE_MAX_DELTA) return false;
+    }
+  }
+
+  for (uint8_t i = 0; i < store_channels; i++) {
+    if (size == 4) write_long(store_address, values[i]);
+    else write_word(store_address, (uint16_t) (values[i] - store_last[i]));
+    store_address += size;
+    store_last[i] = values[i];
+  }
+  store_count++;
+  return true;
+}
+
+//================================================================
+bool GestureLibrary::endStore(void)
+{
+  if (!storing) return false;
+  storing = false;
+
+  if (store_count < 4) {
+    EEPROM.update(store_start, GESTURE_END);
+    return false;
+  }
+  EEPROM.update(store_address, GESTURE_END);
+  write_word(store_start + 4, store_count);
+  EEPROM.update(store_start, store_id);
+  return true;
+}
+
+//================================================================
+bool GestureLibrary::erase(uint8_t id)
+{
+  if (storing || id > GESTURE_MAX_ID) return false;
+
+  int address = find(id);
+  if (address < 0) return false;
+
+  playing = false;
+  if (EEPROM.read(nextRecord(address)) == GESTURE_END) EEPROM.update(address, GESTURE_END);
+  else EEPROM.update(address, GESTURE_DELETED);
+  return true;
+}
+
+//================================================================
+void GestureLibrary::eraseAll(void)
+{
+  storing = false;
+  playing = false;
+
+  // The end marker goes first, so an interrupted erase reads as empty either way.
+  EEPROM.update(GESTURE_FIRST, GESTURE_END);
+  EEPROM.update(GESTURE_BASE, GESTURE_MAGIC);
+  EEPROM.update(GESTURE_BASE + 1, GESTURE_VERSION);
+}
+
+//================================================================
+bool GestureLibrary::list(int *address, uint8_t *id, uint8_t *channels, unsigned int *points)
+{
+  if (storing) return false;
+  if (*address == 0) {
+    if (!hasHeader()) return false;
+    *address = GESTURE_FIRST;
+  }
+
+  for (int next; (next = nextRecord(*address)) >= 0; ) {
+    int record = *address;
+    *address = next;
+    if (EEPROM.read(record) != GESTURE_DELETED) {
+      *id = EEPROM.read(record);
+      *channels = EEPROM.read(record + 1);
+      *points = read_word(record + 4);
+      return true;
+    }
+  }
+  return false;
+}
+
+//================================================================
+bool GestureLibrary::play(uint8_t id, Spline *splines[], uint8_t channels)
+{
+  if (storing || id > GESTURE_MAX_ID) return false;
+
+  int address = find(id);
+  if (address < 0 || EEPROM.read(address + 1) != channels) return false;
+
+  unsigned long segment_time = 1000UL * read_word(address + 2);
+  for (uint8_t i = 0; i < channels; i++) {
+    play_splines[i] = splines[i];
+    splines[i]->reset(segment_time);
+  }
+  play_channels = channels;
+  play_address = address + GESTURE_HEADER;
+  play_index = 0;
+  play_count = read_word(address + 4);
+  playing = true;
+
+  // Every record has at least four points, so the channels can start at once.
+  feed();
+  for (uint8_t i = 0; i < channels; i++) splines[i]->start();
+  return true;
+}
+
+//================================================================
+void GestureLibrary::feed(void)
+{
+  while (play_index < play_count) {
+    for (uint8_t i = 0; i < play_channels; i++) {
+      if (play_splines[i]->space() == 0) return;
+    }
+    for (uint8_t i = 0; i < play_channels; i++) {
+      if (play_index == 0) {
+	play_last[i] = read_long(play_address);
+	play_address += 4;
+      } else {
+	play_last[i] += (int16_t) read_word(play_address);
+	play_address += 2;
+      }
+      play_splines[i]->addPoint(play_last[i]);
+    }
+    play_index++;
+  }
+  playing = false;
+}
+
+//================================================================
+void GestureLibrary::poll(void)
+{
+  if (!playing) return;
+
+  // A channel taken over by another command ends the decoding; the others
+  // play out their buffered points.
+  for (uint8_t i = 0; i < play_channels; i++) {
+    if (!play_splines[i]->isActive()) {
+      playing = false;
+      return;
+    }
+  }
+  feed();
+}
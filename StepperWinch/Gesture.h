@@ -0,0 +1,175 @@
+/// \file Gesture.h
+/// \brief Library of numbered spline gestures stored in EEPROM.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details This class keeps spline gestures in EEPROM so that a cue can be
+/// started by number with no further serial traffic, and so that a board can
+/// perform without a host.  A gesture is a sequence of B-spline control
+/// points for one to four channels, all sharing one segment duration.  It is
+/// not tied to particular axes: the channels are mapped onto the axes named
+/// when it is played.  Playback decodes the points lazily, topping up the
+/// small point buffer of each Spline as segments are consumed, so a gesture
+/// may be far longer than the RAM available for it.
+///
+/// The list begins at the fixed address GESTURE_BASE, well above the
+/// configuration record, so that the configuration layout can grow without
+/// moving the gestures.  It starts with a two byte header, GESTURE_MAGIC and
+/// GESTURE_VERSION; without a valid header the list reads as empty, so a
+/// blank EEPROM or a list in an older layout is never misread, and the
+/// header is rewritten when the next gesture is stored.  Records follow
+/// back-to-back and the list ends with a GESTURE_END byte, which is also the
+/// value of erased EEPROM.  Each record
+/// has a six byte header: id, channel count, segment duration in milliseconds
+/// (16 bits) and point count per channel (16 bits).  The first point of each
+/// channel follows as a 32-bit value, then each later point as a 16-bit
+/// difference from the previous point of its channel, interleaved by
+/// channel.  All values are little-endian.  A three-channel gesture of 100
+/// points needs 612 bytes.
+///
+/// A record is written with the id GESTURE_DELETED and point count
+/// GESTURE_UNFINISHED, which marks the end of the list until the record is
+/// completed: the end marker is written after the data, then the point
+/// count, and finally the id.  A reset while storing therefore never leaves
+/// a partial gesture.  Deleting the last record truncates the list; deleting
+/// an earlier one leaves a hole which is reclaimed when every record after it
+/// has also been deleted.
+///
+/// Each EEPROM byte takes about 3.3 msec to write and the writes block the
+/// main loop, so gestures should be stored while the machine is at rest.
+
+#ifndef __GESTURE_H_INCLUDED__
+#define __GESTURE_H_INCLUDED__
+
+#include <stdint.h>
+#include "Config.h"
+#include "Spline.h"
+
+/// First EEPROM address of the gesture list, above the configuration record.
+#define GESTURE_BASE 256
+
+/// First byte of a valid gesture list.
+#define GESTURE_MAGIC 0x47
+
+/// Layout version of the gesture list.  Change it whenever the record format changes.
+#define GESTURE_VERSION 1
+
+/// Size of the list header in bytes, and the address of the first record.
+#define GESTURE_LIST_HEADER 2
+#define GESTURE_FIRST (GESTURE_BASE + GESTURE_LIST_HEADER)
+
+/// Largest number of channels in one gesture.
+#define GESTURE_CHANNELS 4
+
+/// Largest valid gesture id.
+#define GESTURE_MAX_ID 253
+
+/// Reserved id values for deleted or unfinished records and the end of the list.
+#define GESTURE_DELETED 0xFE
+#define GESTURE_END 0xFF
+
+/// Point count of a record still being written.
+#define GESTURE_UNFINISHED 0xFFFF
+
+/// Size of a record header in bytes.
+#define GESTURE_HEADER 6
+
+// ================================================================
+class GestureLibrary {
+
+private:
+  // Recording state.
+  bool storing;                           ///< true while a record is open
+  uint8_t store_id;                       ///< id to be given to the open record
+  uint8_t store_channels;                 ///< number of channels in the open record
+  int store_start;                        ///< address of the open record
+  int store_address;                      ///< address of the next point
+  unsigned int store_count;               ///< number of points stored per channel
+  long store_last[GESTURE_CHANNELS];      ///< previous point of each channel
+
+  // Playback state.
+  bool playing;                           ///< true while points remain to be decoded
+  uint8_t play_channels;                  ///< number of channels being played
+  Spline *play_splines[GESTURE_CHANNELS]; ///< spline player for each channel
+  int play_address;                       ///< address of the next point
+  unsigned int play_index;                ///< index of the next point
+  unsigned int play_count;                ///< number of points per channel
+  long play_last[GESTURE_CHANNELS];       ///< previous point of each channel
+
+  /// Return true if the list header is valid.
+  bool hasHeader(void);
+
+  /// Return the address following a complete record, or -1 if the address
+  /// holds the end of the list, an unfinished record or invalid data.
+  int nextRecord(int address);
+
+  /// Return the address of a stored gesture, or -1 if not found.
+  int find(uint8_t id);
+
+  /// Return the address at which a new record may be written: just past
+  /// the last gesture not deleted.
+  int freeAddress(void);
+
+  /// Append decoded points to the spline buffers while all have room.
+  void feed(void);
+
+public:
+
+  /// Default constructor.
+  GestureLibrary();
+
+  /// Open a new record, replacing any gesture with the same id.  Returns
+  /// false if the arguments are invalid or there is no room for a point.
+  bool beginStore(uint8_t id, uint8_t channels, unsigned int segment_ms);
+
+  /// Append one point to the open record; the array holds one value per
+  /// channel.  Returns false if no record is open, the EEPROM is full, or a
+  /// value differs from the previous one by more than SPLINE_MAX_DELTA.
+  bool storePoint(const long *values);
+
+  /// Complete the open record.  Returns false and discards the record if it
+  /// has fewer than the four points needed to play.
+  bool endStore(void);
+
+  /// Return true while a record is open.
+  bool isStoring(void) { return storing; }
+
+  /// Return the channel count of the open record.
+  uint8_t storeChannels(void) { return store_channels; }
+
+  /// Delete a stored gesture.  Returns false if not found.
+  bool erase(uint8_t id);
+
+  /// Delete all stored gestures.
+  void eraseAll(void);
+
+  /// Return the number of bytes available for new records.
+  int freeSpace(void);
+
+  /// Step through the stored gestures.  Start with the address set to zero;
+  /// each call returns true and fills in the details of the next gesture, or
+  /// returns false after the last.
+  bool list(int *address, uint8_t *id, uint8_t *channels, unsigned int *points);
+
+  /// Begin playing a stored gesture on the given spline players, one per
+  /// channel of the gesture.  Any earlier playback is abandoned.  Returns
+  /// false if the gesture is not found, has a different number of channels,
+  /// or a record is open.
+  bool play(uint8_t id, Spline *splines[], uint8_t channels);
+
+  /// Stop decoding points; the splines play out the points already buffered.
+  void stop(void) { playing = false; }
+
+  /// Polling function to be called before the splines are updated.
+  void poll(void);
+
+  /// Return true while points remain to be decoded.
+  bool isPlaying(void) { return playing; }
+};
+
+#endif //__GESTURE_H_INCLUDED__
@@ -0,0 +1,177 @@
+/// \file Homing.cpp
+/// \brief Automatic homing sequence for a single winch channel.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <Arduino.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "Homing.h"
+
+// Fast seek speed toward the switch, in steps/sec.
+#define HOMING_SEEK_SPEED 800
+
+// Slow re-approach speed, in steps/sec.
+#define HOMING_APPROACH_SPEED 50
+
+// Distance to back away from the switch after the seek, in steps.
+#define HOMING_BACKOFF 200
+
+// Maximum travel in any phase before giving up, in steps.
+#define HOMING_MAX_TRAVEL 100000L
+
+// Maximum duration of the seek phase, in milliseconds.  This allows the full
+// travel limit at the seek speed with some margin for acceleration.
+#define HOMING_SEEK_TIME 130000UL
+
+// Maximum duration of the back-off and approach phases, in milliseconds.  The
+// approach should close the switch within about HOMING_BACKOFF steps.
+#define HOMING_BACKOFF_TIME 5000UL
+#define HOMING_APPROACH_TIME (2000UL * HOMING_BACKOFF / HOMING_APPROACH_SPEED + 2000UL)
+
+//================================================================
+Homing::Homing(Stepper *_stepper, Path *_path, AxisMonitor *_monitor)
+{
+  stepper = _stepper;
+  path    = _path;
+  monitor = _monitor;
+  state   = IDLE;
+  failed_state = IDLE;
+  start   = 0;
+  phase_start = 0;
+  offset  = 0;
+  saved_speed = INFINITY;
+}
+
+//================================================================
+bool Homing::begin(void)
+{
+  if (monitor->limitPin() == NO_PIN) return false;
+
+  if (!isActive()) saved_speed = path->rampSpeed();
+
+  // The soft limits are meaningless until the axis has been zeroed.
+  path->suspendPositionLimits(true);
+
+  // Any previously learned index is meaningless until the cycle completes.
+  long discard;
+  monitor->clearIndex();
+  monitor->readLatch(&discard);
+  long position = stepper->currentPosition();
+
+  if (monitor->limitActive()) {
+    // Already on the switch: go straight to the back-off.
+    path->setSpeed(HOMING_SEEK_SPEED);
+    path->setTarget(position + HOMING_BACKOFF);
+    enter(BACKOFF, position);
+  } else {
+    path->setVelocity(-HOMING_SEEK_SPEED);
+    enter(SEEK, position);
+  }
+  return true;
+}
+
+//================================================================
+bool Homing::cancel(void)
+{
+  if (!isActive()) return false;
+  finish(FAILED);
+  return true;
+}
+
+//================================================================
+void Homing::enter(uint8_t new_state, long position)
+{
+  start = position;
+  phase_start = millis();
+  state = new_state;
+}
+
+//================================================================
+bool Homing::expired(long position)
+{
+  unsigned long limit;
+  switch (state) {
+  case SEEK:    limit = HOMING_SEEK_TIME;     break;
+  case BACKOFF: limit = HOMING_BACKOFF_TIME;  break;
+  default:      limit = HOMING_APPROACH_TIME; break;
+  }
+  return abs(position - start) > HOMING_MAX_TRAVEL || millis() - phase_start > limit;
+}
+
+//================================================================
+void Homing::finish(uint8_t final_state)
+{
+  if (final_state == FAILED) {
+    failed_state = state;
+    stop();
+  }
+  path->setSpeed(isinf(saved_speed) ? 0 : (long) saved_speed);
+  path->suspendPositionLimits(false);
+  state = final_state;
+}
+
+//================================================================
+bool Homing::poll(void)
+{
+  long position = stepper->currentPosition();
+  long latch;
+
+  switch (state) {
+  case SEEK:
+    if (monitor->readLatch(&latch)) {
+      path->setSpeed(HOMING_SEEK_SPEED);
+      path->setTarget(latch + HOMING_BACKOFF);
+      enter(BACKOFF, position);
+    } else if (expired(position)) finish(FAILED);
+    break;
+
+  case BACKOFF:
+    // Wait for the path to settle at the back-off position.
+    if (abs(position - path->targetPosition()) <= 1 && path->currentVelocity() == 0) {
+      if (monitor->limitActive()) finish(FAILED);
+      else {
+	// Approach slowly with a fresh latch and index so the switch edge is
+	// recorded without correction.
+	monitor->clearIndex();
+	monitor->readLatch(&latch);
+	path->setVelocity(-HOMING_APPROACH_SPEED);
+	enter(APPROACH, position);
+      }
+    } else if (expired(position)) finish(FAILED);
+    break;
+
+  case APPROACH:
+    if (monitor->readLatch(&latch)) {
+      // Shift all the coordinate systems so the switch edge becomes zero,
+      // then hold position there.  The monitor moves its encoder zero too, or
+      // the next encoder check would see the shift as lost steps.
+      offset = latch;
+      noInterrupts();
+      stepper->offsetPosition(-latch);
+      interrupts();
+      monitor->offsetPosition(-latch);
+      path->offsetPosition(-latch);
+      path->setTarget(0);
+      monitor->setIndex(-1, 0);
+      finish(DONE);
+
+    } else if (expired(position)) finish(FAILED);
+    break;
+
+  default:
+    return false;
+  }
+
+  // The motion of the cycle was not commanded by the host, so it is not
+  // answered by a settling event; the 'homed' report serves instead.
+  path->cancelSettling();
+  return !isActive();
+}
+//================================================================
@@ -0,0 +1,90 @@
+/// \file Homing.h
+/// \brief Automatic homing sequence for a single winch channel.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details This class sequences a conventional two-speed homing cycle: the
+/// axis seeks toward its limit switch in the negative direction at a fast
+/// speed, backs off until the switch opens, then re-approaches slowly.  The
+/// step count latched by the AxisMonitor on the slow closing edge becomes the
+/// new zero of both the Stepper and the Path.  Each channel has its own
+/// instance so that all axes may home in parallel.  Soft position limits are
+/// suspended for the duration of the cycle.  Each phase is bounded in both
+/// travel and time, so a stalled axis or a disconnected switch ends in a
+/// failure rather than an endless cycle.
+
+#ifndef __HOMING_H_INCLUDED__
+#define __HOMING_H_INCLUDED__
+
+#include <stdint.h>
+#include "Stepper.h"
+#include "Path.h"
+#include "AxisMonitor.h"
+
+// ================================================================
+class Homing {
+
+public:
+  /// Progress of the homing cycle.
+  enum State { IDLE, SEEK, BACKOFF, APPROACH, DONE, FAILED };
+
+private:
+  Stepper *stepper;       ///< step generator for the channel
+  Path *path;             ///< path generator driving the step generator
+  AxisMonitor *monitor;   ///< source of the latched switch position
+  uint8_t state;          ///< current State value
+  uint8_t failed_state;   ///< State value in which a failure occurred
+  long start;             ///< step position at the start of the current phase
+  unsigned long phase_start; ///< millis() clock at the start of the current phase
+  long offset;            ///< position of the switch in the old coordinates, once done
+  float saved_speed;      ///< path ramp speed to restore when finished
+
+  /// Stop the path generator at its current position.
+  void stop(void) { path->setTarget(path->currentPosition()); }
+
+  /// Finish the cycle, restoring the ramp speed and soft limits.
+  void finish(uint8_t final_state);
+
+  /// Enter a new phase starting from the given step position.
+  void enter(uint8_t new_state, long position);
+
+  /// Return true if the current phase has exceeded its travel or time limit.
+  bool expired(long position);
+
+public:
+
+  /// Main constructor.  The arguments are the objects for the channel.
+  Homing(Stepper *stepper, Path *path, AxisMonitor *monitor);
+
+  /// Begin the homing cycle.  Returns false if the axis has no limit switch.
+  bool begin(void);
+
+  /// End an active cycle as failed in its current phase, leaving the path
+  /// generator free for a new motion command.  Returns true if a cycle was
+  /// running.
+  bool cancel(void);
+
+  /// Polling function to be called from the main event loop.  Returns true
+  /// on the call in which the cycle finishes, after which currentState() is
+  /// DONE or FAILED.
+  bool poll(void);
+
+  /// Return the progress of the cycle.
+  State currentState(void) { return (State) state; }
+
+  /// Return true while a homing cycle is running.
+  bool isActive(void) { return state != IDLE && state != DONE && state != FAILED; }
+
+  /// Return the switch position in the coordinates in use before homing.
+  long switchOffset(void) { return offset; }
+
+  /// Return the phase in which the most recent cycle failed.
+  State failedState(void) { return (State) failed_state; }
+};
+
+#endif //__HOMING_H_INCLUDED__
@@ -0,0 +1,62 @@
+/// \file NumberScanner.cpp
+/// \brief Incremental decimal number scanner for protocol tokens.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <stdint.h>
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#endif
+
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+
+#ifndef pgm_read_float
+#define pgm_read_float(addr) (*(const float *) (addr))
+#endif
+
+#include "NumberScanner.h"
+
+// Powers of ten used to apply the decimal point, kept in flash.
+static const float decimal_scale[10] PROGMEM = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+
+//================================================================
+bool NumberScanner::toLong(long *value)
+{
+  if ((flags & (DIGITS | INVALID | POINT)) != DIGITS) return false;
+
+  if (flags & NEGATIVE) {
+    if (magnitude > 2147483648UL) return false;
+    *value = -(long) (magnitude - 1) - 1;
+  } else {
+    if (magnitude > 2147483647UL) return false;
+    *value = (long) magnitude;
+  }
+  return true;
+}
+
+//================================================================
+bool NumberScanner::toULong(unsigned long *value)
+{
+  if ((flags & (DIGITS | INVALID | SIGN | POINT)) != DIGITS) return false;
+  *value = magnitude;
+  return true;
+}
+
+//================================================================
+bool NumberScanner::toFloat(float *value)
+{
+  if ((flags & (DIGITS | INVALID)) != DIGITS) return false;
+  float result = magnitude;
+  if (decimals) result /= pgm_read_float(&decimal_scale[decimals]);
+  *value = (flags & NEGATIVE) ? -result : result;
+  return true;
+}
+//================================================================
@@ -0,0 +1,72 @@
+/// \file NumberScanner.h
+/// \brief Incremental decimal number scanner for protocol tokens.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details The serial tokenizer feeds each character of a token to a scanner
+/// as it arrives, so by the time the line ends every numeric argument has
+/// already been converted.  This replaces atol() and atof(); in particular it
+/// avoids linking the large AVR floating-point parser.  A token is accepted as
+/// a number if it is an optional sign, decimal digits, and an optional decimal
+/// point followed by at most nine more digits, with a magnitude that fits in
+/// 32 bits.  The value is held as an integer magnitude plus a count of decimal
+/// places, i.e. in decimal fixed-point.
+
+#ifndef __NUMBERSCANNER_H_INCLUDED__
+#define __NUMBERSCANNER_H_INCLUDED__
+
+#include <stdint.h>
+
+// ================================================================
+class NumberScanner {
+
+private:
+  unsigned long magnitude;   ///< absolute value of the digits scanned so far, ignoring the decimal point
+  uint8_t flags;             ///< combination of the flag bits below
+  int8_t decimals;           ///< number of digits following the decimal point
+
+  enum { NEGATIVE = 1, SIGN = 2, DIGITS = 4, POINT = 8, INVALID = 16 };
+
+public:
+
+  /// Prepare to scan a new token.
+  void reset(void) { magnitude = 0; flags = 0; decimals = 0; }
+
+  /// Scan the next character of the token.
+  void scan(char c) {
+    if (c >= '0' && c <= '9') {
+      uint8_t digit = c - '0';
+      if (magnitude > 429496729UL || (magnitude == 429496729UL && digit > 5) || decimals == 9) flags |= INVALID;
+      else {
+	magnitude = 10 * magnitude + digit;
+	flags |= DIGITS;
+	if (flags & POINT) decimals++;
+      }
+    }
+    else if ((c == '-' || c == '+') && flags == 0) flags |= (c == '-') ? (SIGN | NEGATIVE) : SIGN;
+    else if (c == '.' && !(flags & POINT)) flags |= POINT;
+    else flags |= INVALID;
+  }
+
+  /// Scan an entire null-terminated string as one token.
+  void scan(const char *str) { reset(); while (*str) scan(*str++); }
+
+  /// Return the value as a signed integer.  Returns false if the token was
+  /// not an integer within range; any decimal point, even a trailing one as
+  /// in "1.", makes the token a float.
+  bool toLong(long *value);
+
+  /// Return the value as an unsigned integer, e.g. a clock value.  Returns
+  /// false if the token was not an unsigned integer.
+  bool toULong(unsigned long *value);
+
+  /// Return the value as a float.  Returns false if the token was not a number.
+  bool toFloat(float *value);
+};
+
+#endif //__NUMBERSCANNER_H_INCLUDED__
@@ -0,0 +1,139 @@
+/// \file Oscillator.cpp
+/// \brief Periodic gesture generator for a single winch channel.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <Arduino.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "Oscillator.h"
+#include "SineTable.h"
+
+// Number of whole cycles by which an oscillator may lag others sharing its
+// noise sequence.
+#define NOISE_HISTORY 16
+
+//================================================================
+Oscillator::Oscillator(Path *_path)
+{
+  path = _path;
+  waveform = SINE;
+  active = false;
+  releasing = false;
+  amplitude = 0.0;
+  frequency = 0.0;
+  phase = 0.0;
+  level = 0.0;
+  attack_rate = 0.0;
+  release_rate = 0.0;
+  noise_state = 1;
+  noise_start = 0.0;
+  noise_end = 0.0;
+}
+
+//================================================================
+float Oscillator::noise(void)
+{
+  // xorshift32 generator, scaled to [-1, 1]
+  noise_state ^= noise_state << 13;
+  noise_state ^= noise_state >> 17;
+  noise_state ^= noise_state << 5;
+  return (float) (noise_state >> 8) * (2.0f / 16777215.0f) - 1.0f;
+}
+
+//================================================================
+void Oscillator::start(Waveform _waveform, long _amplitude, float _frequency, float _phase, float attack, uint32_t seed)
+{
+  waveform  = _waveform;
+  amplitude = _amplitude;
+  frequency = _frequency;
+  phase     = _phase - floorf(_phase);
+  attack_rate = (attack > 0.0) ? 1.0 / attack : INFINITY;
+  releasing = false;
+  if (!active) level = 0.0;
+  active = true;
+
+  // Each whole cycle of lag starts one value earlier in the shared noise
+  // sequence, so lagging oscillators trace the same values later.
+  long skip = NOISE_HISTORY + (long) floorf(_phase);
+  noise_state = seed ? seed : 1;
+  for (skip = constrain(skip, 0, NOISE_HISTORY); skip > 0; skip--) noise();
+  noise_start = noise();
+  noise_end   = noise();
+}
+
+//================================================================
+void Oscillator::release(float seconds)
+{
+  if (!active) return;
+  release_rate = (seconds > 0.0) ? 1.0 / seconds : INFINITY;
+  releasing = true;
+}
+
+//================================================================
+void Oscillator::stop(void)
+{
+  path->setTargetOffset(0.0);
+  active = false;
+  releasing = false;
+  level = 0.0;
+}
+
+//================================================================
+void Oscillator::pollForInterval(unsigned long interval)
+{
+  if (!active) return;
+
+  float dt = 1e-6 * interval;
+
+  // Advance the envelope.
+  if (releasing) {
+    level -= release_rate * dt;
+    if (!(level > 0.0)) {
+      stop();
+      return;
+    }
+  } else if (level < 1.0) {
+    // An instant attack is applied directly, since an infinite rate times a
+    // zero interval would give NaN.
+    level = isinf(attack_rate) ? 1.0 : level + attack_rate * dt;
+    if (level > 1.0) level = 1.0;
+  }
+
+  // Advance the phase, choosing a new noise value at each cycle boundary.
+  phase += frequency * dt;
+  if (phase >= 1.0) {
+    phase -= floorf(phase);
+    noise_start = noise_end;
+    noise_end = noise();
+  }
+
+  float value;
+  switch (waveform) {
+  case TRIANGLE:
+    // rises through zero at the start of the cycle, in step with the sine
+    if (phase < 0.25)      value = 4.0 * phase;
+    else if (phase < 0.75) value = 2.0 - 4.0 * phase;
+    else                   value = 4.0 * phase - 4.0;
+    break;
+
+  case NOISE: {
+    // smoothstep interpolation has zero slope at the random values
+    float s = phase * phase * (3.0 - 2.0 * phase);
+    value = noise_start + s * (noise_end - noise_start);
+    break;
+  }
+
+  default:
+    value = fast_sin((uint16_t) (phase * 65536.0)) * (1.0 / SINE_SCALE);
+    break;
+  }
+
+  path->setTargetOffset(amplitude * level * value);
+}
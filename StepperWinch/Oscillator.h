@@ -0,0 +1,82 @@
+/// \file Oscillator.h
+/// \brief Periodic gesture generator for a single winch channel.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details This class superimposes a periodic waveform on the target of a
+/// Path: a sine, a triangle, or smoothed random noise, scaled by an
+/// attack/release envelope.  The waveform is applied as the Path target
+/// offset, kept apart from the target itself, so ordinary motion commands
+/// move the center of the oscillation without disturbing it, and the target
+/// returns to that center once the envelope has been released.  The Path
+/// dynamics smooth the result as usual.
+///
+/// Oscillators started together with the same frequency remain phase-locked
+/// since they advance their phase identically; giving each a different
+/// initial phase produces a ripple across the axes.
+
+#ifndef __OSCILLATOR_H_INCLUDED__
+#define __OSCILLATOR_H_INCLUDED__
+
+#include <stdint.h>
+#include "Path.h"
+
+// ================================================================
+class Oscillator {
+
+public:
+  /// Available waveforms.  Noise interpolates smoothly between random values
+  /// chosen once per cycle.
+  enum Waveform { SINE, TRIANGLE, NOISE };
+
+private:
+  Path *path;             ///< path generator whose target is modulated
+  uint8_t waveform;       ///< current Waveform value
+  bool active;            ///< true while the oscillator is modulating the target
+  bool releasing;         ///< true once the envelope is decaying
+  float amplitude;        ///< peak offset in steps
+  float frequency;        ///< cycles per second
+  float phase;            ///< position within the cycle, in [0, 1)
+  float level;            ///< envelope level, from 0 to 1
+  float attack_rate;      ///< envelope rise per second
+  float release_rate;     ///< envelope fall per second
+  uint32_t noise_state;   ///< random number generator state for noise
+  float noise_start;      ///< noise value at the start of the current cycle
+  float noise_end;        ///< noise value at the end of the current cycle
+
+  /// Return the next random value in [-1, 1].
+  float noise(void);
+
+public:
+
+  /// Main constructor.  The argument is the path generator for the channel.
+  Oscillator(Path *path);
+
+  /// Start or retune the oscillator.  The amplitude is in steps, the frequency
+  /// in Hz, the phase in cycles, and the attack in seconds to reach full
+  /// amplitude.  The envelope rises from its present level, so a running
+  /// oscillator can be changed without a jump in amplitude.  Oscillators
+  /// given the same seed produce the same noise sequence.
+  void start(Waveform waveform, long amplitude, float frequency, float phase, float attack, uint32_t seed);
+
+  /// Fade the oscillator out over the given number of seconds, after which it
+  /// stops with the target at the center.
+  void release(float seconds);
+
+  /// Stop immediately, returning the target to the center.
+  void stop(void);
+
+  /// Polling function to be called before the path generator is updated.  The
+  /// interval argument is the duration in microseconds since the last call.
+  void pollForInterval(unsigned long interval);
+
+  /// Return true while the oscillator is modulating the target.
+  bool isActive(void) { return active; }
+};
+
+#endif //__OSCILLATOR_H_INCLUDED__
@@ -19,21 +19,107 @@ Path::Path()
 {
   q    = 0.0;
   qd   = 0.0;
-  qdd  = 0.0;
   q_d  = 0.0;
   qd_d = 0.0;
 
   q_d_d = 0.0;
+  target_offset = 0.0;
   speed = INFINITY;
 
-  t = 0;
-  
   // Initialize the second-order model response to 2 Hz natural frequency, with
   // a damping ratio of 1.0 for critical damping.
   setFreqDamping(2.0, 1.0);
   
   qd_max  = 2400.0;     // typical physical limit for 4x microstepping
   qdd_max = 24000.0;
+
+  q_min = -INFINITY;
+  q_max = INFINITY;
+  limits_suspended = false;
+
+  waypoint_count = 0;
+  exit_speed = 0.0;
+
+  setSettling(-1.0, 0.0, 0.0);
+}
+
+//================================================================
+void Path::incrementTarget(long offset)
+{
+  q_d_d += offset;
+  armSettling();
+  for (uint8_t i = 0; i < waypoint_count; i++) waypoints[i] += offset;
+}
+
+//================================================================
+void Path::offsetPosition(long offset)
+{
+  q += offset;
+  q_d += offset;
+  q_d_d += offset;
+  for (uint8_t i = 0; i < waypoint_count; i++) waypoints[i] += offset;
+}
+
+//================================================================
+bool Path::addWaypoint(long position)
+{
+  if (waypoint_count == PATH_WAYPOINTS) return false;
+  waypoints[waypoint_count++] = position;
+  q_d_d = position;
+  armSettling();
+  planWaypoints();
+  return true;
+}
+
+//================================================================
+// Plan the speed at the next waypoint.  Working back from a stop at the last
+// waypoint, the speed at each earlier one is limited by the cruising speed and
+// by the distance available to slow to the speed at the following one, and
+// is zero wherever the direction of travel reverses.
+void Path::planWaypoints(void)
+{
+  float v = 0.0;
+  for (int8_t i = waypoint_count - 2; i >= 0; i--) {
+    float before = waypoints[i] - ((i > 0) ? waypoints[i-1] : q_d);
+    float after  = waypoints[i+1] - waypoints[i];
+    if (before * after <= 0.0) v = 0.0;
+    else {
+      float reachable = sqrtf(v * v + 2 * waypointAcceleration() * fabsf(after));
+      v = min(cruiseSpeed(), reachable);
+    }
+  }
+  exit_speed = v;
+}
+
+//================================================================
+// Move the reference toward the next waypoint, accelerating up to the
+// cruising speed but never faster than allows slowing to the planned exit
+// speed on arrival.
+void Path::followWaypoints(float dt, float lower, float upper)
+{
+  float error = constrain(waypoints[0] + target_offset, lower, upper) - q_d;
+  float direction = (error >= 0.0) ? 1.0 : -1.0;
+  float distance = fabsf(error);
+
+  // (each bound is computed once since min() may be a macro)
+  float v = max(0.0f, direction * qd_d) + waypointAcceleration() * dt;
+  float cruise = cruiseSpeed();
+  float stopping = sqrtf(exit_speed * exit_speed + 2 * waypointAcceleration() * distance);
+  v = min(v, cruise);
+  v = min(v, stopping);
+
+  float step = v * dt;
+  if (step < distance) {
+    q_d += direction * step;
+    qd_d = direction * v;
+  } else {
+    // Arrive and continue at the planned exit speed toward the next waypoint.
+    q_d += error;
+    for (uint8_t i = 1; i < waypoint_count; i++) waypoints[i-1] = waypoints[i];
+    waypoint_count--;
+    qd_d = (waypoint_count > 0) ? direction * exit_speed : 0.0;
+    if (waypoint_count > 0) planWaypoints();
+  }
 }
 
 //================================================================
@@ -41,32 +127,62 @@ Path::Path()
 void Path::pollForInterval(unsigned long interval)
 {
   float dt = 1e-6 * interval;
+  float lower = limits_suspended ? -PATH_POSITION_LIMIT : max(q_min, -PATH_POSITION_LIMIT);
+  float upper = limits_suspended ? PATH_POSITION_LIMIT : min(q_max, PATH_POSITION_LIMIT);
+
+  // keep the reference within the soft limits, e.g. after an impulse
+  q_d = constrain(q_d, lower, upper);
 
   // calculate the derivatives
   float qdd = k * (q_d - q) + b * (qd_d - qd);
 
+  // Brake at full deceleration once the stopping distance reaches the soft
+  // limit ahead, or the end of the position range.
+  float remaining = (qd > 0.0) ? (upper - q) : (q - lower);
+  if (qd != 0.0 && qd * qd >= 2 * qdd_max * remaining) qdd = (qd > 0.0) ? -qdd_max : qdd_max;
+
   // clamp the acceleration within range for safety
   qdd = constrain(qdd, -qdd_max, qdd_max);
 
   // integrate one time step
   q  += qd  * dt;
   qd += qdd * dt;
-  t += dt;
 
   // clamp the model velocity within range for safety
   qd = constrain(qd, -qd_max, qd_max);
 
+  // Time how long the model has rested near its final target.  In velocity
+  // mode the reference velocity is zero once the ramp is stopped or held at a
+  // limit, which stands in for reaching a target.
+  if (settle_pending) {
+    bool arrived = isfinite(q_d_d) ? fabsf(constrain(q_d_d + target_offset, lower, upper) - q) <= settle_tolerance : qd_d == 0.0;
+    if (waypoint_count == 0 && arrived && fabsf(qd) <= settle_speed) {
+      settle_elapsed += dt;
+      if (settle_elapsed >= settle_dwell) {
+	settle_pending = false;
+	settle_done = true;
+      }
+    } else settle_elapsed = 0.0;
+  }
+
+  // Follow any queued waypoints with a planned speed profile.
+  if (waypoint_count > 0) {
+    followWaypoints(dt, lower, upper);
+    return;
+  }
+
   // Update the reference trajectory using linear interpolation.  This can
   // create steps or ramps.  This calculates the maximum desired step, bounds it
   // to the speed, then applies the sign to move in the correct direction.
-  float q_d_err = q_d_d - q_d;  // maximum error step
+  float goal = constrain(q_d_d + target_offset, lower, upper);  // target, never beyond a limit
+  float q_d_err = goal - q_d;  // maximum error step
 
   if (q_d_err == 0.0) {
     qd_d = 0.0;  // make sure reference velocity is zero, leave reference position unchanged
 
   } else {
     if (isinf(speed)) {
-      q_d = q_d_d;      // infinite speed, always adjust reference in one step
+      q_d = goal;       // infinite speed, always adjust reference in one step
       qd_d = 0.0;       // then assume zero velocity
     } else {            // else calculate a ramp step
       float d_q_d_max = speed * dt; // maximum linear step, possibly infinite
@@ -12,11 +12,48 @@
 /// generating gestural motions on a single motor channel.  It assumes a
 /// separate controller manages the step generator of closed-loop control of the
 /// physical hardware.
+///
+/// Optional soft position limits confine the motion regardless of the
+/// commanded target: the reference never leaves the limits, and whenever the
+/// model could no longer stop at the acceleration limit before reaching one,
+/// it brakes at that acceleration.  A velocity command therefore ends in a
+/// controlled stop at the limit instead of running away.
+///
+/// A short queue of waypoints may be followed instead of a single target.  The
+/// reference then moves with a trapezoidal speed profile, at half the
+/// acceleration limit and at the ramp speed (or the velocity limit if the ramp speed is
+/// unlimited), and passes through each waypoint without stopping.  The speed
+/// at each waypoint is planned ahead over the whole queue as in a CNC motion
+/// planner: it is zero where the direction reverses and at the last waypoint,
+/// and otherwise is the highest speed from which every later stop can still
+/// be made.
+///
+/// Settling detection reports when the model has converged after a command:
+/// once every new target, velocity, waypoint or impulse, the model must come
+/// within a position tolerance of the target (or the limit short of it) at
+/// below a speed tolerance, and stay there for a dwell time.  A velocity
+/// command has no target; it settles once the ramp has stopped, at zero
+/// velocity or at a limit, and the model is below the speed tolerance.  Each command is
+/// answered by exactly one settling event, even if it caused no motion, so a
+/// host can chain moves without guessing their duration.
+///
+/// Positions are confined to +/-PATH_POSITION_LIMIT even when the soft limits
+/// are unset or suspended, and the model brakes at that range as at a soft
+/// limit.  The fixed-point outputs are clamped to the same range, so with up to
+/// 8 fractional bits they always fit in 32 bits.
 
 #ifndef __PATH_H_INCLUDED__
 #define __PATH_H_INCLUDED__
 
 #include <math.h>
+#include <stdint.h>
+
+/// Maximum number of queued waypoints per path.
+#define PATH_WAYPOINTS 4
+
+/// Largest position magnitude in units.  With the 8 fractional bits used by
+/// the Stepper, 32-bit fixed point overflows at 2^23 = 8388608 steps.
+#define PATH_POSITION_LIMIT 8000000.0f
 
 // ================================================================
 class Path {
@@ -24,18 +61,47 @@ class Path {
 private:
   float q;    	   ///< current model position, in dimensionless units (e.g. step or encoder counts)
   float qd;   	   ///< current model velocity in units/sec
-  float qdd;  	   ///< current model acceleration, in units/sec/sec
   float q_d;  	   ///< current model reference position in dimensionless units
   float qd_d;  	   ///< current model reference velocity in dimensionless units/sec
 
   float q_d_d; 	   ///< user-specified target position in dimensionless units
+  float target_offset; ///< offset added to the target and waypoints by a modulator, e.g. an Oscillator
   float speed;     ///< user-specified target speed in dimensionless units/sec
 
-  float t;    	   ///< elapsed model time, in seconds
   float k;    	   ///< proportional feedback gain, in (units/sec/sec)/(units), which is (1/sec^2)
   float b;    	   ///< derivative feedback gain, in (units/sec/sec)/(units/sec), which is (1/sec)
   float qd_max;    ///< maximum allowable speed in units/sec
   float qdd_max;   ///< maximum allowable acceleration in units/sec/sec
+  float q_min;     ///< lower soft position limit, or -INFINITY
+  float q_max;     ///< upper soft position limit, or INFINITY
+  bool limits_suspended; ///< true while the soft limits are ignored, e.g. during homing
+
+  float waypoints[PATH_WAYPOINTS]; ///< queued waypoint positions, the next first
+  uint8_t waypoint_count;          ///< number of queued waypoints
+  float exit_speed;                ///< planned reference speed on reaching the next waypoint
+
+  float settle_tolerance;  ///< settling position tolerance in units, or negative if disabled
+  float settle_speed;      ///< settling speed tolerance in units/sec
+  float settle_dwell;      ///< time in seconds the model must remain settled
+  float settle_elapsed;    ///< time in seconds the model has been settled so far
+  bool settle_pending;     ///< true while a command awaits its settling event
+  bool settle_done;        ///< true once settled, until reported
+
+  /// Begin waiting for the model to settle after a new command.
+  void armSettling(void) { settle_pending = (settle_tolerance >= 0.0); settle_elapsed = 0.0; }
+
+  /// Return the reference cruising speed used to follow waypoints.
+  float cruiseSpeed(void) { return isinf(speed) ? qd_max : speed; }
+
+  /// Return the reference acceleration used to follow waypoints.  This is
+  /// half the model limit, leaving the model room to track the reference.
+  float waypointAcceleration(void) { return 0.5 * qdd_max; }
+
+  /// Recompute exit_speed by a backward pass over the waypoint queue.
+  void planWaypoints(void);
+
+  /// Advance the reference along the waypoint queue for one time step.
+  void followWaypoints(float dt, float lower, float upper);
 
 public:
 
@@ -50,15 +116,35 @@ public:
   /// Add a signed offset to the target position.  The units are dimensionless
   /// 'steps'.  If using a microstepping driver, these may be less than a
   /// physical motor step.
-  void incrementTarget(long offset) { q_d_d += offset; }
+  /// Any queued waypoints are shifted by the same offset.
+  void incrementTarget(long offset);
 
   /// Add a signed offset to the reference position.  This can have  the
   /// effect of applying a triangular impulse; the reference trajectory will
   /// make a step, then ramp back to the target position.
-  void incrementReference(long offset) { q_d += offset; }
+  void incrementReference(long offset) { q_d += offset; armSettling(); }
+
+  /// Drive the reference directly from an external trajectory generator,
+  /// with the position in dimensionless units and the feedforward velocity in
+  /// units/sec.  This must be repeated before every poll; the target follows
+  /// the reference so the ramp generator holds still.
+  void setReference(float position, float velocity) { q_d = q_d_d = position; qd_d = velocity; waypoint_count = 0; armSettling(); }
 
-  /// Set the absolute target position in dimensionless units.
-  void setTarget(long position) { q_d_d = position; }
+  /// Bring the model to rest at once at the given position in dimensionless
+  /// units, e.g. the step position when the drivers are switched off.  The
+  /// target moves there too and any queued waypoints are discarded.
+  void stop(long position) { q = q_d = q_d_d = position; qd = qd_d = 0.0; waypoint_count = 0; }
+
+  /// Set the absolute target position in dimensionless units, discarding any
+  /// queued waypoints.
+  void setTarget(long position) { q_d_d = position; waypoint_count = 0; armSettling(); }
+
+  /// Append a waypoint at an absolute position in dimensionless units.  The
+  /// target becomes the last waypoint.  Returns false if the queue is full.
+  bool addWaypoint(long position);
+
+  /// Return the number of queued waypoints not yet reached.
+  uint8_t pendingWaypoints(void) { return waypoint_count; }
 
   /// Set the ramp speed in dimensionless units/second.  If less than or equal to zero,
   /// it is treated as unlimited, and the
@@ -66,19 +152,50 @@ public:
   void setSpeed(long newspeed) { speed = (newspeed <= 0) ? INFINITY : newspeed; }
 
   /// Set the ramp velocity in dimensionless units/second, either positive or negative.
-  /// The ramp target position is set to reflect the sign of the change.
+  /// The ramp target position is set to reflect the sign of the change.  Any
+  /// queued waypoints are discarded.
   void setVelocity(long newspeed) {
+    waypoint_count = 0;
+    armSettling();
     speed = abs(newspeed);
     if (newspeed >= 0)  q_d_d = INFINITY;
     else                q_d_d = -INFINITY;
   }
 
+  /// Return the ramp speed in dimensionless units/second, possibly infinite.
+  float rampSpeed(void) { return speed; }
+
+  /// Return the target position in dimensionless units.
+  long targetPosition(void) { return (long) q_d_d; }
+
+  /// Set an offset added to the target position and waypoints, kept separate
+  /// from them so that later motion commands do not absorb it.  This is meant
+  /// for a modulator such as an Oscillator and does not count as a command for
+  /// settling detection.
+  void setTargetOffset(float offset) { target_offset = offset; }
+
+  /// Return true if the target is a position, false while moving at a set velocity.
+  bool hasTarget(void) { return isfinite(q_d_d); }
+
+  /// Shift the whole model state by a signed offset, e.g. to move the origin
+  /// after homing.  The motion is unaffected, and since this is not a new
+  /// command it does not start a settling check.
+  void offsetPosition(long offset);
+
   /// Return the current position in dimensionless units.
   long currentPosition(void) { return (long) q; }
 
   /// Return the current velocity in units/second.
   long currentVelocity(void) { return (long) qd; }
 
+  /// Return the current position as a fixed-point value with the given number
+  /// of fractional bits, at most 8.
+  long currentPositionFixed(uint8_t bits) { return (long) ldexpf(constrain(q, -PATH_POSITION_LIMIT, PATH_POSITION_LIMIT), bits); }
+
+  /// Return the current velocity in units/second as a fixed-point value with
+  /// the given number of fractional bits, at most 8.
+  long currentVelocityFixed(uint8_t bits) { return (long) ldexpf(constrain(qd, -PATH_POSITION_LIMIT, PATH_POSITION_LIMIT), bits); }
+
   /// Configure the second-order model gains.
   void setPDgains(float k_new, float b_new) { k = k_new; b = b_new; }
 
@@ -90,8 +207,48 @@ public:
     b = 2 * sqrtf(k) * damping;
   }
 
+  /// Return the proportional gain in 1/sec^2.
+  float proportionalGain(void) { return k; }
+
+  /// Return the derivative gain in 1/sec.
+  float derivativeGain(void) { return b; }
+
+  /// Return the velocity limit in units/second.
+  float velocityLimit(void) { return qd_max; }
+
+  /// Return the acceleration limit in units/second/second.
+  float accelerationLimit(void) { return qdd_max; }
+
   /// Configure the velocity and acceleration limits.
   void setLimits(float qdmax, float qddmax) { qd_max = qdmax; qdd_max = qddmax; }
+
+  /// Configure the soft position limits in dimensionless units.  Infinite
+  /// values leave that side unbounded.
+  void setPositionLimits(float lower, float upper) { q_min = lower; q_max = upper; }
+
+  /// Return the lower soft position limit, possibly -INFINITY.
+  float lowerPositionLimit(void) { return q_min; }
+
+  /// Return the upper soft position limit, possibly INFINITY.
+  float upperPositionLimit(void) { return q_max; }
+
+  /// Configure settling detection: the position tolerance in units, the
+  /// speed tolerance in units/sec, and the dwell time in seconds.  A negative
+  /// position tolerance disables it.
+  void setSettling(float tolerance, float speed, float dwell) {
+    settle_tolerance = tolerance; settle_speed = speed; settle_dwell = dwell;
+    settle_pending = settle_done = false;
+  }
+
+  /// Return true once after the model has settled following a command.
+  bool settleEvent(void) { bool done = settle_done; settle_done = false; return done; }
+
+  /// Abandon any settling check in progress or unreported, e.g. for motion
+  /// generated internally rather than commanded.
+  void cancelSettling(void) { settle_pending = settle_done = false; }
+
+  /// Temporarily ignore the soft position limits, or restore them.
+  void suspendPositionLimits(bool suspend) { limits_suspended = suspend; }
 };
 
 #endif //__PATH_H_INCLUDED__
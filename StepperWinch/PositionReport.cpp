@@ -0,0 +1,45 @@
+/// \file PositionReport.cpp
+/// \brief Report-on-change filter for the position of a single winch channel.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <Arduino.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include "PositionReport.h"
+
+//================================================================
+PositionReport::PositionReport()
+{
+  deadband = -1;
+  last = 0;
+}
+
+//================================================================
+void PositionReport::setDeadband(long steps)
+{
+  deadband = steps;
+
+  // Force a report of the current position on the next sample.
+  last = (steps >= 0) ? LONG_MIN : 0;
+}
+
+//================================================================
+bool PositionReport::poll(long position)
+{
+  if (deadband < 0) return false;
+
+  // The unsigned difference cannot overflow, even from the initial value.
+  unsigned long change = (position >= last) ? (unsigned long) position - last : (unsigned long) last - position;
+  if (change > (unsigned long) deadband) {
+    last = position;
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,48 @@
+/// \file PositionReport.h
+/// \brief Report-on-change filter for the position of a single winch channel.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details Periodic status frames carry every axis whether or not it has
+/// moved, and are too infrequent to follow a fast move.  This class instead
+/// decides when one channel's position is worth sending: whenever it has
+/// moved more than a deadband from the last value sent.  The caller samples
+/// it at a fixed rate, which bounds the message rate of a moving channel; an
+/// idle channel sends nothing.  Arrival on a target is reported separately
+/// by the settling detection of Path.
+
+#ifndef __POSITIONREPORT_H_INCLUDED__
+#define __POSITIONREPORT_H_INCLUDED__
+
+#include <stdint.h>
+
+// ================================================================
+class PositionReport {
+
+private:
+  long deadband;      ///< change in steps needed to report, or negative if disabled
+  long last;          ///< most recently reported position
+
+public:
+
+  /// Default constructor.  Change reporting starts disabled.
+  PositionReport();
+
+  /// Enable reporting of changes larger than the deadband in steps, or
+  /// disable it if the deadband is negative.  The next sample is reported.
+  void setDeadband(long steps);
+
+  /// Return true if change reporting is enabled.
+  bool isEnabled(void) { return deadband >= 0; }
+
+  /// Sample the channel position in steps.  Returns true if it has changed
+  /// by more than the deadband since it was last reported.
+  bool poll(long position);
+};
+
+#endif //__POSITIONREPORT_H_INCLUDED__
@@ -0,0 +1,128 @@
+/// \file Spline.cpp
+/// \brief Uniform cubic B-spline trajectory player for a single winch channel.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <Arduino.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "Spline.h"
+
+// Multiply by a power of two.  A left shift would be undefined for negative values.
+static inline int64_t scale(int64_t value, uint8_t bits)
+{
+  return value * ((int64_t) 1 << bits);
+}
+
+//================================================================
+Spline::Spline(Path *_path)
+{
+  path = _path;
+  playing = false;
+  reset(100000);
+}
+
+//================================================================
+void Spline::reset(unsigned long _segment_time)
+{
+  if (playing) path->setTarget(path->currentPosition());
+  head = count = step = 0;
+  playing = false;
+  segment_time = (_segment_time > 0) ? _segment_time : 1;
+  elapsed = 0;
+
+  // Use the fewest steps which keep each within SPLINE_STEP_TIME.
+  step_bits = SPLINE_MIN_STEP_BITS;
+  while (step_bits < SPLINE_MAX_STEP_BITS && (segment_time >> step_bits) > SPLINE_STEP_TIME) step_bits++;
+  velocity_scale = ldexpf(1e6 / segment_time, step_bits - fractionBits());
+  position = 0;
+  delta1 = delta2 = delta3 = 0;
+}
+
+//================================================================
+bool Spline::accepts(long value)
+{
+  if (count == SPLINE_POINTS) return false;
+  return count == 0 || abs(value - point(count - 1)) <= SPLINE_MAX_DELTA;
+}
+
+//================================================================
+bool Spline::addPoint(long value)
+{
+  if (!accepts(value)) return false;
+  points[(head + count) % SPLINE_POINTS] = value;
+  count++;
+  return true;
+}
+
+//================================================================
+bool Spline::start(void)
+{
+  if (playing) return true;
+  if (!beginSegment()) return false;
+  elapsed = 0;
+  playing = true;
+  return true;
+}
+
+//================================================================
+// For control points P0..P3 the segment is x(t) = a t^3 + b t^2 + c t + d with
+//   6a = -P0 + 3 P1 - 3 P2 + P3,  2b = P0 - 2 P1 + P2,  2c = P2 - P0,  6d = P0 + 4 P1 + P2.
+// With step h = 2^-n the forward differences are
+//   delta1 = a h^3 + b h^2 + c h,  delta2 = 6a h^3 + 2b h^2,  delta3 = 6a h^3,
+// which are integers in the fixed-point scale of 3n fractional bits except for
+// the division in delta1.
+bool Spline::beginSegment(void)
+{
+  if (count < 4) return false;
+
+  long p0 = point(0), p1 = point(1), p2 = point(2), p3 = point(3);
+  long d3 = -p0 + 3 * p1 - 3 * p2 + p3;
+  long d2 = p0 - 2 * p1 + p2;
+  long d1 = p2 - p0;
+
+  position = scale(p0 + 4 * p1 + p2, fractionBits()) / 6;
+  delta3 = d3;
+  delta2 = d3 + scale(d2, step_bits);
+  delta1 = (d3 + 3 * scale(d2, step_bits) + 3 * scale(d1, 2 * step_bits)) / 6;
+  step = 0;
+  return true;
+}
+
+//================================================================
+bool Spline::pollForInterval(unsigned long interval)
+{
+  if (!playing) return false;
+
+  // Take one step for each 1/2^n of a segment elapsed, keeping the remainder
+  // so that segments are timed exactly.
+  elapsed += interval << step_bits;
+  while (elapsed >= segment_time) {
+    elapsed -= segment_time;
+    position += delta1;
+    delta1 += delta2;
+    delta2 += delta3;
+
+    if (++step == (1U << step_bits)) {
+      // Discard the oldest point and continue with the next segment.
+      head = (head + 1) % SPLINE_POINTS;
+      count--;
+      if (!beginSegment()) {
+	// Out of points: hold the final position.
+	playing = false;
+	path->setTarget(lround(ldexpf((float) position, -fractionBits())));
+	return true;
+      }
+    }
+  }
+
+  // The fixed-point state is converted only here, at the Path boundary.
+  path->setReference(ldexpf((float) position, -fractionBits()), velocity_scale * delta1);
+  return false;
+}
@@ -0,0 +1,119 @@
+/// \file Spline.h
+/// \brief Uniform cubic B-spline trajectory player for a single winch channel.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details This class plays a gesture described by a queue of B-spline
+/// control points, one segment per fixed time interval, by driving the Path
+/// reference directly.  Each segment depends on four consecutive control
+/// points; once it has been played the oldest point is discarded, so a host
+/// may keep appending points during playback and a long gesture needs only a
+/// few points per second of serial traffic.  The curve does not pass through
+/// the control points; repeating the first and last points three times makes
+/// it start and end exactly on them.
+///
+/// The curve is evaluated by forward differencing at 2^n evenly spaced steps
+/// per segment.  Each step is three 64-bit integer additions; the multiplies
+/// which derive the differences from the control points are needed only once
+/// per segment.  The Path model is in floating point, so each poll still
+/// converts the fixed-point position to a float and scales the first
+/// difference to a velocity, one conversion and one multiply per channel,
+/// the same cost as any other source driving a Path reference.  The step count is chosen from the segment
+/// duration so that a step lasts at most SPLINE_STEP_TIME, from 2^6 steps for
+/// short segments up to 2^12, so long segments do not play as a staircase.
+/// The position carries 3n fractional bits, so the differences of the cubic
+/// are exact apart from one division, and each segment restarts from exact
+/// values.
+
+#ifndef __SPLINE_H_INCLUDED__
+#define __SPLINE_H_INCLUDED__
+
+#include <stdint.h>
+#include "Path.h"
+
+/// Number of control points buffered per channel.
+#define SPLINE_POINTS 8
+
+/// Range of the number of forward difference steps per segment, as powers of two.
+#define SPLINE_MIN_STEP_BITS 6
+#define SPLINE_MAX_STEP_BITS 12
+
+/// Longest interval between forward difference steps, in microseconds, for
+/// segments short enough to allow it.
+#define SPLINE_STEP_TIME 1000
+
+/// Largest difference allowed between consecutive control points, in steps,
+/// which keeps the differences within 64 bits at the finest step size.
+#define SPLINE_MAX_DELTA 32767L
+
+// ================================================================
+class Spline {
+
+private:
+  Path *path;                       ///< path generator whose reference is driven
+  long points[SPLINE_POINTS];       ///< circular buffer of control points, in steps
+  uint8_t head;                     ///< index of the oldest control point
+  uint8_t count;                    ///< number of buffered control points
+  uint8_t step_bits;                ///< forward difference steps per segment, as a power of two
+  uint16_t step;                    ///< forward difference steps taken in the current segment
+  bool playing;                     ///< true while segments are being played
+  unsigned long segment_time;       ///< duration of each segment in microseconds
+  unsigned long elapsed;            ///< time toward the next step, in units of 2^-step_bits microseconds
+  float velocity_scale;             ///< converts a first difference to steps/sec
+  int64_t position;                 ///< current position with 3 * step_bits fractional bits
+  int64_t delta1, delta2, delta3;   ///< first, second and third forward differences
+
+  /// Return the fractional bits of the fixed-point position.
+  uint8_t fractionBits(void) { return 3 * step_bits; }
+
+  /// Return the control point at an offset from the oldest.
+  long point(uint8_t i) { return points[(head + i) % SPLINE_POINTS]; }
+
+  /// Load the forward differences for the segment starting at the oldest
+  /// point.  Returns false if fewer than four points are buffered.
+  bool beginSegment(void);
+
+public:
+
+  /// Main constructor.  The argument is the path generator for the channel.
+  Spline(Path *path);
+
+  /// Discard all control points and stop, leaving the path at rest at its
+  /// current reference.  The segment duration is in microseconds.
+  void reset(unsigned long segment_time);
+
+  /// Append a control point in steps.  Returns false if the buffer is full
+  /// or the point is too far from the previous one.
+  bool addPoint(long position);
+
+  /// Return true if addPoint() would accept the control point.
+  bool accepts(long position);
+
+  /// Start playing once four control points are buffered.  Returns false if
+  /// there are too few.
+  bool start(void);
+
+  /// Return true if start() would succeed.
+  bool isReady(void) { return playing || count >= 4; }
+
+  /// Stop playing, leaving the control points buffered.
+  void stop(void) { playing = false; }
+
+  /// Polling function to be called before the path generator is updated.  The
+  /// interval argument is the duration in microseconds since the last call.
+  /// Returns true on the call in which playback runs out of control points.
+  bool pollForInterval(unsigned long interval);
+
+  /// Return true while the spline is driving the path.
+  bool isActive(void) { return playing; }
+
+  /// Return the number of control points which may still be appended.
+  uint8_t space(void) { return SPLINE_POINTS - count; }
+};
+
+#endif //__SPLINE_H_INCLUDED__
@@ -16,11 +16,38 @@ Stepper::Stepper(uint8_t _step_pin, uint8_t _dir_pin)
   step_pin = _step_pin;
   dir_pin  = _dir_pin;
   position = 0;
-  target   = 0;
+  reference = 0;
+  remainder = 0;
+  rate      = 0;
   elapsed  = 0;
+  direction = 0;
+  dir_level = 0xff;
+  pulse_active = false;
 
   step_interval = 200;  // 200 microseconds = 5000 steps/sec
 }
+//================================================================
+void Stepper::incrementTarget(long offset)
+{
+  noInterrupts();
+  reference += STEP_FIXED(offset);
+  interrupts();
+}
+
+//================================================================
+void Stepper::setTrajectory(long position, long velocity)
+{
+  // Rescale the velocity from units/sec to units per 2^20 microseconds so the
+  // interrupt handler can carry the remainder with a shift instead of a divide.
+  long new_rate = (long) (velocity * 1.048576);
+
+  noInterrupts();
+  reference = position;
+  remainder = 0;
+  rate = new_rate;
+  interrupts();
+}
+
 //================================================================
 // Step generator running on fast timer interrupt.
 void Stepper::pollForInterval(unsigned long interval)
@@ -28,24 +55,56 @@ void Stepper::pollForInterval(unsigned long interval)
   // Accumulated the time elapsed since the step.
   elapsed += interval;
 
-  if (elapsed >= step_interval) {
-    // reset the timer according to the target interval to produce a correct an
-    // average rate even if extra time has passed
-    elapsed -= step_interval;
+  // Extrapolate the reference along the feedforward velocity.
+  if (rate != 0) {
+    remainder += rate * (long) interval;
+    reference += remainder >> 20;
+    remainder &= 0xfffff;
+  }
+
+  // End a pulse raised on the previous poll.  No new pulse may start on this
+  // poll, so both the high and low times last at least one polling period.
+  if (pulse_active) {
+    digitalWrite(step_pin, LOW);
+    pulse_active = false;
+    return;
+  }
 
+  // Step when the reference lies beyond the midpoint to the adjacent step,
+  // plus a small hysteresis so that setpoint corrections near the boundary
+  // do not produce a step back and forth.
+  long error = reference - STEP_FIXED(position);
+  const long threshold = STEP_FIXED(1)/2 + STEP_FIXED(1)/16;
+
+  if (elapsed >= step_interval) {
     // check whether to emit a step
-    if (position != target) {
+    if (error > threshold || error < -threshold) {
 
-      // always set the direction to match the sign of motion
-      digitalWrite(dir_pin, (position < target) ? HIGH : LOW);
+      // A change of direction is output alone and the step follows on the
+      // next poll, which provides the direction setup and hold times.
+      uint8_t level = (error > 0) ? HIGH : LOW;
+      if (level != dir_level) {
+	digitalWrite(dir_pin, level);
+	dir_level = level;
+	return;
+      }
 
-      // emit a step
+      // reset the timer according to the target interval to produce a correct
+      // average rate even if extra time has passed
+      elapsed -= step_interval;
+      if (elapsed > step_interval) elapsed = step_interval;
+
+      // begin a step pulse, ended by the next poll
       digitalWrite(step_pin, HIGH);
+      pulse_active = true;
 
       // update the position count
-      if (position < target) position++;
-      else position--;
-      digitalWrite(step_pin, LOW);
+      if (error > 0) { position++; direction = 1; }
+      else           { position--; direction = -1; }
+
+    } else {
+      // while idle, allow the next step as soon as the reference moves
+      elapsed = step_interval;
     }
   }
 }
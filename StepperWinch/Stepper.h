@@ -11,13 +11,33 @@
 /// \details This class implements fast constant-velocity stepping.  It is
 /// possible to use this directly, but the overall sketch pairs this with a
 /// interpolating path generator which frequently updates the position and
-/// velocity setpoints.
+/// velocity setpoints.  The setpoints are fixed-point values with a
+/// fractional part, and the reference is extrapolated along the velocity
+/// between updates, so each step is emitted on the first poll after the
+/// continuous reference crosses the step boundary.
+///
+/// The A4988 needs the step input high and low for at least 1 usec each, and
+/// the direction input stable 200 nsec before and after each rising edge.
+/// Rather than rely on the duration of the code between pin writes, each
+/// poll makes at most one output change per channel: a step pulse is raised
+/// on one poll and lowered at the start of the next, and a change of
+/// direction is output on a poll of its own, delaying the step which follows
+/// it by one polling period.  Every interval is then at least a full polling
+/// period whatever the speed of the port writes, at the cost of limiting the
+/// step rate to half the polling rate.
 
 #ifndef __STEPPER_H_INCLUDED__
 #define __STEPPER_H_INCLUDED__
 
 #include <stdint.h>
 
+/// Number of fractional bits in fixed-point step positions and velocities.
+#define STEP_FRACTION_BITS 8
+
+/// Convert an integer step count to fixed-point.  This multiplies rather than
+/// shifts, since a left shift of a negative value is undefined.
+#define STEP_FIXED(steps) ((long) (steps) * (1L << STEP_FRACTION_BITS))
+
 /// An instance of this class manages generation of step and direction signals
 /// for one stepper motor.
 class Stepper {
@@ -30,21 +50,36 @@ private:
   /// the I/O pins for this channel designated using the Arduino convention
   uint8_t step_pin, dir_pin;
 
-  /// the target position in dimensionless step counts
-  long target;
-
-  /// the interval in microseconds between steps
+  /// the minimum interval in microseconds between steps
   unsigned long step_interval;
 
+  /// the signed feedforward velocity in fixed-point steps per 2^20 microseconds
+  long rate;
+
   /****************************************************************/
   // The following instance variables may be modified within poll() from an interrupt context.
 
+  /// the fixed-point reference position in dimensionless step counts
+  long reference;
+
+  /// the extrapolation remainder below one fixed-point unit, in units of 2^-20
+  long remainder;
+
   /// the current position in dimensionless step counts
   long position;
 
   /// the time elapsed in microseconds since the last step occurred
   unsigned long elapsed;
 
+  /// the sign of the most recent step: +1, -1, or 0 if none has occurred
+  int8_t direction;
+
+  /// the level last written to the direction output, or 0xff before the first
+  uint8_t dir_level;
+
+  /// true while the step output is high
+  bool pulse_active;
+
   /****************************************************************/
 public:
 
@@ -60,18 +95,38 @@ public:
   /// Add a signed offset to the target position.  The units are dimensionless
   /// 'steps'.  If using a microstepping driver, these may be less than a
   /// physical motor step.
-  void incrementTarget(long offset) { target += offset; }
+  void incrementTarget(long offset);
+
+  /// Set the absolute target position and stop any extrapolation.
+  void setTarget(long position) { setTrajectory(STEP_FIXED(position), 0); }
 
-  /// Set the absolute target position.
-  void setTarget(long position) { target = position; }
+  /// Set the reference as a fixed-point position and a fixed-point signed
+  /// velocity in steps/sec at which the reference is extrapolated until the
+  /// next update.  Both have STEP_FRACTION_BITS fractional bits.
+  void setTrajectory(long position, long velocity);
 
   /// Return the current position in dimensionless 'steps'.
   long currentPosition(void) { return position; }
 
-  /// Set a constant speed in steps/second.  Note that the value must be
-  /// non-zero and positive.  The maximum rate available is a function of the
-  /// polling rate.
-  void setSpeed(int speed) {
+  /// Return the sign of the most recent step, or zero if none has occurred.
+  int8_t lastDirection(void) { return direction; }
+
+  /// Add a signed correction to the current position, e.g. to account for
+  /// steps lost by the motor.  The generator will then emit steps to restore
+  /// the target.  This must be called from an interrupt context or with
+  /// interrupts disabled since the position is updated by poll().
+  void adjustPosition(long offset) { position += offset; }
+
+  /// Shift both the current and target positions by a signed offset, e.g. to
+  /// move the origin after homing.  No steps result.  The same interrupt
+  /// restrictions as adjustPosition() apply.
+  void offsetPosition(long offset) { position += offset; reference += STEP_FIXED(offset); }
+
+  /// Set the maximum step rate in steps/second, which also sets the constant
+  /// speed used to approach a fixed target.  Note that the
+  /// value must be non-zero and positive.  The maximum rate available is
+  /// half the polling rate.
+  void setSpeed(long speed) {
     // (1000000 microseconds/second) / (steps/second) = (microseconds/step)
     if (speed > 0) {
       step_interval = 1000000 / speed;
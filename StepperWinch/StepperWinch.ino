@@ -24,6 +24,12 @@
 /// configured for 1/4 step microstepping (MS2 pulled high).  However, the
 /// protocol commands use integer step units so the code does not depend on
 /// this.
+///
+/// The full sketch needs more static RAM than the 2 KB of the ATmega328P on an
+/// Uno.  On such processors the memory-lean profile (LEAN_BUILD) is chosen by
+/// default, which leaves out spline playback, stored gestures and
+/// oscillators; a board with more RAM such as a Mega 2560 runs the full
+/// profile.  host/ram_report.sh measures either profile.
 
 // ================================================================
 // Import the TimerOne library to support timer interrupt processing.
@@ -33,6 +39,15 @@
 #include "cnc_shield.h"
 #include "Stepper.h"
 #include "Path.h"
+#include "SyncClock.h"
+#include "AxisMonitor.h"
+#include "Homing.h"
+#include "Oscillator.h"
+#include "Spline.h"
+#include "Config.h"
+#include "PositionReport.h"
+#include "Gesture.h"
+#include "NumberScanner.h"
 
 // ================================================================
 // Communication protocol.
@@ -49,14 +64,99 @@
 // Command	Arguments		Meaning
 // ping                                 query whether the server is running
 // version				query the identity of the sketch
-// srate        <value>                 set the status reporting interval in milliseconds
-// enable       <value>                 enable or disable all driver outputs, value is 0 or non-zero
+// srate        <value>                 set the status reporting interval in milliseconds; also the heartbeat when reporting on change
+// enable       <value>                 enable or disable all driver outputs, value is 0 or non-zero; disabling stops all motion
+// clock                                query the disciplined clock, replies with a clock message
+// sync         <board> <host> [<rtt>]  discipline the clock: when the board clock read <board> usec, the host clock read <host> usec; <rtt> is the round-trip delay
+// at           <usec> <command>+       execute the remaining command when the disciplined clock reaches <usec>
+// baud         <rate>                  propose or confirm a serial line rate of 115200, 250000, 500000 or 1000000
+// save                                 store the path gains, velocity limits, ramp speeds and status rate in EEPROM
+// save         clear                   discard the stored settings, so the defaults apply after a reset
+// load                                 restore the stored settings
+// power        <idle-ms> <hold-%>      reduce driver power after the given quiet time; zero time disables
+
+// ----------------------------------------------------------------
+// Saved settings.  At reset the sketch restores the settings last stored with
+// 'save', if any, before the serial port opens: for every channel the 'g'
+// gains, 'l' limits and 's' ramp speed, and the 'srate' interval and 'power'
+// settings.  The record is versioned and checksummed; if it is missing or
+// damaged the defaults are used instead.  The 'limit' soft limits are not
+// saved: they are in homed coordinates, which mean nothing until the axis has
+// been homed again, so they must be set after each 'home'.
+//
+// Examples:
+//   save			keep the current tuning across power cycles
+
+// ----------------------------------------------------------------
+// Driver power management.  The drivers share one enable line.  Once no
+// channel has stepped or had motion pending for the idle time in
+// milliseconds, the drivers are switched off, or if a VREF PWM output is
+// wired (DRIVER_VREF_PWM_PIN), held at the given percentage of full current.
+// The next motion command restores full power, and the paths wait a further
+// two milliseconds for the motor current to build before stepping resumes.
+// A zero idle time keeps the drivers on.
+//
+// Examples:
+//   power 30000 0		switch the drivers off after half a minute at rest
+//   power 2000 40		hold at 40% current after two seconds (needs DRIVER_VREF_PWM_PIN)
+
+// ----------------------------------------------------------------
+// Acknowledgement.  Any command line may be prefixed with a sequence number
+// token of the form @<number>.  After the line has been processed the sketch
+// replies 'ack <number> <credit>' if it succeeded or 'nak <number> <credit>'
+// if it was malformed, in place of the usual debugging message.  A malformed
+// line is rejected before it has any effect, including a streamed motion
+// command; a nak after a valid line means a queue or buffer was full.  An
+// 'at' line is acknowledged when it is queued, and errors when it later runs
+// are reported as debugging messages.  The credit is the free space in bytes
+// of the serial receive buffer when the reply was sent, so a host can keep
+// that much data in flight without overrunning it.
+//
+// Examples:
+//   @41 a xyza 100 120 -200 -50	absolute move, acknowledged as 'ack 41 63'
+
+// ----------------------------------------------------------------
+// Line rate negotiation.  The sketch always starts at BAUD_RATE.  A host
+// proposes a faster rate with 'baud <rate>'; the sketch replies 'baud <rate>'
+// at the old rate and then switches.  The host switches too and confirms by
+// sending the same 'baud <rate>' line at the new rate, which is answered with
+// a final 'baud <rate>'.  If the confirmation does not arrive within one
+// second, or any other line arrives first, the sketch returns to the previous
+// rate and announces it with a 'baud' message.  Once a faster rate is in use,
+// three consecutive corrupted lines restore BAUD_RATE the same way.  The
+// faster rates are exact divisors of the 16 MHz clock, unlike 115200.
+//
+// Examples:
+//   baud 1000000		propose, then confirm, one megabit per second
+
+// ----------------------------------------------------------------
+// Clock synchronization.  Several boards can be driven against a common host
+// timebase.  The host periodically sends 'clock', notes its own send time T1
+// and receive time T3 around the 'clock <T2>' reply, and then sends
+// 'sync <T2> <(T1+T3)/2> <T3-T1>'.  A host which knows the line rate should
+// use the midpoint of T1 plus the transmission time of the 'clock' line and T3
+// less that of the reply, and subtract both transmission times from the
+// round-trip time, which is optional.  The board steps its clock on the first
+// sample or any large error.  Otherwise it keeps only the exchanges with the
+// shortest round trips, whose timing is most symmetric, and fits the phase
+// and frequency trim to the last several of them to cancel crystal skew.
+// Each 'sync' is answered with the measured offset and the trim in use.
+// Commands prefixed with 'at <usec>' are then held and executed when the
+// disciplined clock reaches the given time, so that coordinated motion
+// starts simultaneously on all boards.
+//
+// Examples:
+//   at 120000000 a xyza 100 120 -200 -50	start an absolute move at t=120 seconds
 
 // ----------------------------------------------------------------
 // The following messages include a token representing the flag set specifying
 // the affected axes.  The flag set should include one or more single-letter
 // channel specifiers (regex form: "[xyza]+").  Note that the flag set cannot be
-// empty.
+// empty, and may not repeat a channel.  Positions are confined to +/-8000000
+// steps, the range of the fixed-point step generator.  Motion commands must
+// supply exactly one integer value per channel.  The values are checked as
+// they arrive but take effect together once the line ends; if any value is
+// malformed or missing, the whole line is ignored with a debugging message.
 
 // --------------------------------
 
@@ -74,6 +174,26 @@
 
 // --------------------------------
 
+// Waypoint move. There should be an integer position corresponding to each
+// included channel, which is appended to that channel's queue of up to four
+// waypoints.  The channel passes through its waypoints in order without
+// stopping between them, slowing only where the direction reverses and at the
+// last one; speed is limited by the 's' ramp speed (or the 'l' velocity limit
+// if unset) and half the 'l' acceleration limit.  The path gains still filter
+// the result, so a higher 'g' frequency follows the waypoints more closely.
+// If any included queue is full the line is ignored.  An absolute move,
+// velocity command or homing discards the queue.  Note that this command will
+// enable all drivers.
+//
+//   w <flags> <position>+
+//
+// Examples:
+//   w x 400			queue waypoints at 400, 800 and 1200 for a fast
+//   w x 800			move with no stops at 400 or 800
+//   w x 1200
+
+// --------------------------------
+
 // Relative move. There should be an offset value corresponding to each included
 // channel; each controller target is incremented by the specified amount.  The
 // motion is not coordinated; different channels may finish at different times.
@@ -121,6 +241,44 @@
 //   s xyza 10 10 10 10		set all axes to ramp at 10 steps per second toward the target
 //   s x 500			set the X axis to ramp at 500 steps/second
 
+// --------------------------------
+// Index checking.  Each closing edge of an axis limit switch latches the step
+// count.  The first edge from each direction records the switch position; any
+// later edge which disagrees by more than the tolerance is treated as lost
+// steps and the step count is corrected.  A negative tolerance disables
+// checking and forgets the recorded switch positions.
+//   index <flags> <tolerance>
+//
+// Examples:
+//   index xyz 2		correct errors of more than two steps on the X, Y and Z axes
+//   index x -1			disable checking on the X axis
+
+// --------------------------------
+// Homing.  Each included axis with a limit switch seeks toward the switch in
+// the negative direction, backs off, and re-approaches slowly; the step
+// position at the slow switch edge becomes zero.  All included axes home in
+// parallel and each reports completion with a homed or homefail message.  A
+// phase fails if it exceeds its travel or time limit, and a motion, play or osc
+// command naming a homing axis cancels its cycle with a homefail report in the
+// phase then running.  Note that this command will enable all drivers.
+//   home <flags>
+//
+// Examples:
+//   home xyz			home the X, Y and Z axes
+
+// --------------------------------
+// Encoder checking.  If quadrature encoders are compiled in (USE_ENCODERS),
+// sets the scale as a ratio of steps per encoder count and zeros the encoder at
+// the current position.  While correction is enabled with 'index', errors
+// beyond the encoder tolerance are corrected continuously during motion.  The
+// tolerance defaults to the steps in one encoder count, rounded up, and at
+// least one.  A zero count disables the encoder check.
+//   encoder <flags> <steps> <counts> [<tolerance>]
+//
+// Examples:
+//   encoder xy 800 1000	800 steps for each 1000 encoder counts
+//   encoder x 4 1 8		4 steps per count, ignoring errors up to 8 steps
+
 // --------------------------------
 // Set second-order gains.  The same dynamic parameters are applied to all included channels.
 //   g <flags> <frequency (Hz)> <damping-ratio>
@@ -131,24 +289,163 @@
 
 // --------------------------------
 // Set velocity and acceleration limits.  The same dynamic parameters are applied to all included channels.
+// The step generator can emit at most 5000 steps/sec (MAX_STEP_RATE), so a
+// higher velocity limit is rejected; a saved one is reduced to it on loading.
 //   l <flags> <maximum velocity (steps/sec)> <maximum acceleration (steps/sec/sec)>
 //
 // Examples:
 //   l xyza 4000 40000		set all channels to 4000 steps/sec and 40000 steps/sec/sec
 
+// --------------------------------
+// Spline gestures.  A gesture is uploaded as uniform cubic B-spline control
+// points, in steps, and played back on the board: each channel covers one
+// segment per interval, passing smoothly near its control points, and
+// consumes one point per segment.  'spline' clears the points of each
+// included channel and sets the segment duration in milliseconds; 'k'
+// appends one control point per channel (up to eight may be buffered) and may
+// continue during playback; 'play' starts the included channels together
+// once each has four points.  Both apply to all included channels or, if any
+// is not ready, to none.  A channel which runs out of points holds its
+// last position.  Repeat the first and last points three times to start and
+// end exactly on them.  An absolute, relative, waypoint or velocity move or
+// homing stops playback.  Note that 'play' will enable all drivers.  Splines
+// and stored gestures are left out of the lean profile (USE_SPLINES).
+//   spline <flags> <segment-ms>
+//   k <flags> <point>+
+//   play <flags>
+//
+// Examples:
+//   spline xy 250		quarter-second segments on X and Y
+//   k xy 0 0			(three times) start at the origin
+//   k xy 400 -200		a control point
+//   play xy			start both channels in step
+
+// --------------------------------
+// Stored gestures.  A spline gesture may be kept in EEPROM under a number
+// from 0 to 253 and later played with no further traffic.  'store' opens a
+// gesture with the given segment duration in milliseconds; the flags only set
+// its number of channels.  Each following 'k' line must name that many
+// channels and appends one point to the stored gesture instead of the spline
+// buffers.  'store end' completes it; at least four points are needed.
+// Storing a number already in use replaces that gesture.  'play' with a
+// number maps the stored channels in order onto the included axes, which need
+// not be those used to store it, and starts at once; the points are read
+// back as needed, so a gesture may be far longer than the spline buffers.
+// The positions are absolute.  'erase' deletes one or all gestures and
+// 'gestures' lists them.  EEPROM writes take several milliseconds per point
+// and delay the main loop, so store gestures while the machine is at rest.
+//   store <id> <flags> <segment-ms>
+//   store end
+//   play <id> <flags>
+//   erase <id>
+//   erase all
+//   gestures
+//
+// Examples:
+//   store 3 xy 250		begin two-channel gesture 3 with quarter-second segments
+//   k xy 400 -200		(repeated) append a point
+//   store end			complete the gesture
+//   play 3 za			perform gesture 3 on the Z and A axes
+
+// --------------------------------
+// Report on change.  Each included channel sends its position with a 'pos'
+// message whenever it has moved more than the deadband in steps since the
+// last report, checked every 10 msec.  An idle channel sends nothing.  The
+// 'txyza' frames continue at the 'srate' interval as a heartbeat, so with
+// every channel reporting on change 'srate' may be set to several seconds.
+// Arrival on a target is reported by the 'done' message of 'settle'.
+//   report <flags> <deadband>
+//   report <flags> off
+//
+// Examples:
+//   report xyza 5		report each change of more than five steps
+//   srate 5000			heartbeat frame every five seconds
+//   report xyza off		return to periodic frames only
+
+// --------------------------------
+// Settling events.  Each included channel answers every later position,
+// velocity, waypoint or impulse command with one 'done' message once its
+// motion has converged: within the tolerance in steps of its target, slower
+// than the speed tolerance in steps/sec, continuously for the dwell time in
+// milliseconds.  A velocity command has no target, so it converges once its
+// ramp has stopped, at zero velocity or at a soft limit, and the model is
+// below the speed tolerance.  A command which causes no motion is answered
+// after the dwell.  Oscillation and spline playback postpone the event until
+// they end.
+//   settle <flags> <tolerance> <speed> <dwell-ms>
+//   settle <flags> off
+//
+// Examples:
+//   settle xyza 2 20 100	done when within 2 steps and 20 steps/sec for 0.1 sec
+//   a x 500			... answered later by 'done x 500'
+//   v x 0			... answered by 'done' once the X axis has slowed to a stop
+
+// --------------------------------
+// Set soft position limits, in steps.  The same limits are applied to all
+// included channels.  No target, velocity or oscillation can carry a channel
+// past a limit: it brakes at the acceleration limit in time to stop there.
+// The limits are suspended while homing and apply to the homed coordinates;
+// they are not kept by 'save'.
+// Limits which exclude the present position of any included channel are
+// rejected, so setting limits never moves a channel by itself.
+//   limit <flags> <minimum> <maximum>
+//   limit <flags> off
+//
+// Examples:
+//   limit xyza -2000 12000	confine all channels to -2000..12000 steps
+//   limit x off		remove the X axis limits
+
+// --------------------------------
+// Oscillate.  Each included channel superimposes a periodic waveform on its
+// target: 'sine', 'tri', or 'noise' (smoothed random values, one per cycle).
+// The amplitude is in steps and the frequency in Hz.  Channels started by
+// one command are phase-locked; each successive channel in flag order lags
+// the previous by the phase step in degrees, so a single command produces a
+// ripple.  The amplitude rises from zero over the attack time in seconds.
+// Motion commands continue to move the center of the oscillation.  Note that
+// this command will enable all drivers.  Oscillators are left out of the
+// lean profile (USE_OSCILLATORS), as is 'release'.
+//   osc <flags> <waveform> <amplitude> <frequency> <phase-step> <attack>
+//
+// Examples:
+//   osc xyza sine 200 0.25 90 2	breathe on all axes, rippling a quarter cycle apart
+//   osc z noise 50 1.5 0 0.5		sway the Z axis randomly around its target
+
+// --------------------------------
+// Release oscillation.  The amplitude of each included channel fades to zero
+// over the given time in seconds, leaving the target at the center.
+//   release <flags> <seconds>
+//
+// Examples:
+//   release xyza 3		fade out all oscillation over three seconds
+
 // ----------------------------------------------------------------
 // This program generates the following messages:
 
 // Command	Arguments		Meaning
 // awake                                initialization has completed or ping was received
-// txyza        <usec> <x> <y> <z> <a>  Arduino clock time in microseconds, followed by absolute step position
+// txyza        <usec> <x> <y> <z> <a>  disciplined clock time in microseconds, followed by absolute step position
+// clock        <usec>                  disciplined clock time in microseconds
+// sync         <error> <trim>          measured clock offset in microseconds and frequency trim in parts per billion
+// baud         <rate>                  reply to a rate proposal or confirmation, or announcement of a fallback rate
+// pos          <axis> <steps>          the channel has moved past its reporting deadband
+// done         <axis> <steps>          the channel has settled after the last command
+// lost         <axis> <steps>          an index or encoder check corrected the given number of lost steps
+// homed        <axis> <offset>         homing finished; offset is the switch position in the previous coordinates
+// homefail     <axis> <phase>          homing failed or was cancelled in the given phase (1 seek, 2 back-off, 3 approach)
+// stored       <bytes>                 a gesture was completed; bytes of EEPROM remain free
+// gesture      <id> <channels> <points> one stored gesture, in reply to 'gestures'
+// free         <bytes>                 bytes of EEPROM free for gestures, ending the 'gestures' list
+// ack          <sequence> <credit>     the numbered command line was applied
+// nak          <sequence> <credit>     the numbered command line was rejected
 // dbg		<value-or-token>+	debugging message to print for user
 // id		<tokens>+		tokens identifying the specific sketch
 
 // ================================================================
 // Global variables and constants.
 
-// The baud rate is the number of bits per second transmitted over the serial port.
+// The baud rate is the number of bits per second transmitted over the serial
+// port.  This is the startup rate; faster rates may be negotiated at runtime.
 #define BAUD_RATE 115200
 
 // Interval in microseconds between status messages.
@@ -162,22 +459,219 @@ static Stepper y_axis(Y_AXIS_STEP_PIN, Y_AXIS_DIR_PIN);
 static Stepper z_axis(Z_AXIS_STEP_PIN, Z_AXIS_DIR_PIN);
 static Stepper a_axis(A_AXIS_STEP_PIN, A_AXIS_DIR_PIN);
 
+/// Define as 1 to count quadrature encoders on the X and Y axes.
+#define USE_ENCODERS 0
+
+/// Define as 1 for the memory-lean build profile, which leaves out the
+/// optional modules below so the sketch fits the 2 KB of RAM of an ATmega328P
+/// with room for the stack.  Unless set otherwise, e.g. with
+/// -DLEAN_BUILD=0 from host/ram_report.sh, it is chosen on processors with no
+/// more than 2 KB of RAM.
+#ifndef LEAN_BUILD
+#if defined(RAMEND) && RAMEND <= 0x8FF
+#define LEAN_BUILD 1
+#else
+#define LEAN_BUILD 0
+#endif
+#endif
+
+/// Define as 1 to include spline playback and the stored gesture library,
+/// about 390 bytes of RAM.
+#define USE_SPLINES (!LEAN_BUILD)
+
+/// Define as 1 to include the gesture oscillators, about 160 bytes of RAM.
+#define USE_OSCILLATORS (!LEAN_BUILD)
+
+/// Step-loss monitor for each channel.  The A axis has no limit input.
+static AxisMonitor x_monitor(&x_axis, X_LIMIT_PIN);
+static AxisMonitor y_monitor(&y_axis, Y_LIMIT_PIN);
+static AxisMonitor z_monitor(&z_axis, Z_LIMIT_PIN);
+static AxisMonitor a_monitor(&a_axis, NO_PIN);
+
+/// Number of stepper channels, and the flag letter for each in channel order.
+#define NUM_AXES 4
+static const char axis_letters[] PROGMEM = "xyza";
+
 /// Path generator object for each channel.
 static Path x_path, y_path, z_path, a_path;
 
+/// Homing sequencer for each channel.
+static Homing x_homing(&x_axis, &x_path, &x_monitor);
+static Homing y_homing(&y_axis, &y_path, &y_monitor);
+static Homing z_homing(&z_axis, &z_path, &z_monitor);
+static Homing a_homing(&a_axis, &a_path, &a_monitor);
+
+#if USE_OSCILLATORS
+/// Gesture oscillator for each channel.
+static Oscillator x_oscillator(&x_path);
+static Oscillator y_oscillator(&y_path);
+static Oscillator z_oscillator(&z_path);
+static Oscillator a_oscillator(&a_path);
+#endif
+
+#if USE_SPLINES
+/// Spline trajectory player for each channel.
+static Spline x_spline(&x_path);
+static Spline y_spline(&y_path);
+static Spline z_spline(&z_path);
+static Spline a_spline(&a_path);
+
+/// Library of spline gestures stored in EEPROM.
+static GestureLibrary gestures;
+#endif
+
+/// Report-on-change filter for each channel.
+static PositionReport x_report, y_report, z_report, a_report;
+
+/// Interval in microseconds at which channels reporting on change are sampled.
+#define REPORT_CHECK_INTERVAL 10000
+
+/// Longest spline segment duration, in milliseconds.
+#define MAX_SPLINE_SEGMENT 60000L
+
+/// Interval in microseconds between polls of the step generators.
+#define STEPPER_PERIOD 100
+
+/// Highest step rate in steps/sec: each step pulse occupies two polls.
+#define MAX_STEP_RATE (500000L / STEPPER_PERIOD)
+
+/// Highest accepted oscillation frequency, in Hz.
+#define MAX_OSCILLATOR_FREQUENCY 20.0
+
 /// The timestamp in microseconds for the last polling cycle, used to compute
 /// the exact interval between stepper motor updates.
 static unsigned long last_interrupt_clock = 0;
 
+/// Disciplined clock shared with the host and other boards.
+static SyncClock sync_clock;
+
+/// Maximum number of time-tagged commands awaiting execution.
+#define SCHEDULE_SLOTS 3
+
+/// Maximum stored length of a time-tagged command including token terminators.
+#define SCHEDULE_LENGTH 40
+
+/// Maximum number of tokens in a time-tagged command.
+#define MAX_SCHEDULED_TOKENS 8
+
+/// Queue of time-tagged commands, held in order of execution time.  Each
+/// command is stored as consecutive null-terminated tokens.
+static struct {
+  unsigned long time;              ///< disciplined time at which to execute
+  uint8_t argc;                    ///< number of stored tokens
+  char tokens[SCHEDULE_LENGTH];    ///< null-terminated tokens stored back-to-back
+} schedule[SCHEDULE_SLOTS];
+
+/// Number of entries in the schedule queue, and index of the earliest.
+static uint8_t schedule_count = 0, schedule_head = 0;
+
+/// Time in microseconds allowed for the motor current to build after the
+/// drivers are enabled or return to full current, during which the paths are held.
+#define DRIVER_WAKE_DELAY 2000
+
+/// Driver power state.
+static bool drivers_enabled = false;        ///< true while the enable output is active
+static bool drivers_holding = false;        ///< true while at the reduced holding current
+static unsigned long driver_idle_time = 0;  ///< quiet time in microseconds before power is reduced, or zero
+static uint8_t driver_hold_level = 0;       ///< holding current as a PWM level, or zero to switch off
+static long driver_idle_timer = 0;          ///< remaining quiet time in microseconds
+static long driver_wake_timer = 0;          ///< remaining wake delay in microseconds
+
 /// Identification string.
-static const char version_string[] = "id StepperWinch " __DATE__;
+static const char version_string[] PROGMEM = "id StepperWinch " __DATE__;
+
+// ================================================================
+/// Return the path generator for each channel, in channel order.
+static Path *channel_path(int i)
+{
+  switch (i) {
+  case 0: return &x_path;
+  case 1: return &y_path;
+  case 2: return &z_path;
+  default: return &a_path;
+  }
+}
+
+// ================================================================
+/// Store the persistent settings in EEPROM.
+static void save_config(void)
+{
+  WinchConfig config;
+  for (int i = 0; i < CONFIG_AXES; i++) {
+    Path *p = channel_path(i);
+    AxisConfig *axis = &config.axes[i];
+    axis->k = p->proportionalGain();
+    axis->b = p->derivativeGain();
+    axis->qd_max = p->velocityLimit();
+    axis->qdd_max = p->accelerationLimit();
+    axis->speed = isinf(p->rampSpeed()) ? 0 : (long) p->rampSpeed();
+  }
+  config.status_interval = status_poll_interval;
+  config.driver_idle_time = driver_idle_time;
+  config.driver_hold_level = driver_hold_level;
+  config_save(&config);
+}
+
+// ================================================================
+/// Restore the persistent settings from EEPROM.  Returns false if none are
+/// stored.
+static bool load_config(void)
+{
+  WinchConfig config;
+  if (!config_load(&config)) return false;
+
+  for (int i = 0; i < CONFIG_AXES; i++) {
+    Path *p = channel_path(i);
+    AxisConfig *axis = &config.axes[i];
+    p->setPDgains(axis->k, axis->b);
+    p->setLimits(fminf(axis->qd_max, MAX_STEP_RATE), axis->qdd_max);
+    p->setSpeed(axis->speed);
+  }
+  status_poll_interval = config.status_interval;
+  driver_idle_time = config.driver_idle_time;
+  driver_hold_level = config.driver_hold_level;
+  return true;
+}
 
 // ================================================================
-/// Enable or disable the stepper motor drivers.  The output is active-low,
-/// so this inverts the sense.
-static inline void set_driver_enable(int value)
+/// Stop every step generator at its present step, so the interrupt handler
+/// issues no steps until the next update from path_poll().
+static void hold_steppers(void)
 {
-  digitalWrite(STEPPER_ENABLE_PIN, (value != 0) ? LOW : HIGH);
+  x_axis.setTarget(x_axis.currentPosition());
+  y_axis.setTarget(y_axis.currentPosition());
+  z_axis.setTarget(z_axis.currentPosition());
+  a_axis.setTarget(a_axis.currentPosition());
+}
+
+// ================================================================
+/// Enable or disable the stepper motor drivers at full current.  The output
+/// is active-low, so this inverts the sense.  Enabling drivers which were off
+/// or holding starts the wake delay, and either restarts the idle timer.  The
+/// step generators are stopped whenever the drivers are switched off or begin
+/// to wake, and disabling them mid-motion also brings each path to rest at its
+/// step position, since the motors can no longer follow.
+static void set_driver_enable(int value)
+{
+  if (value == 0 && drivers_enabled) {
+    x_path.stop(x_axis.currentPosition());
+    y_path.stop(y_axis.currentPosition());
+    z_path.stop(z_axis.currentPosition());
+    a_path.stop(a_axis.currentPosition());
+    hold_steppers();
+  }
+  if (value != 0 && (!drivers_enabled || drivers_holding)) {
+    driver_wake_timer = DRIVER_WAKE_DELAY;
+    hold_steppers();
+  }
+  drivers_enabled = (value != 0);
+  drivers_holding = false;
+  driver_idle_timer = driver_idle_time;
+
+#ifdef DRIVER_VREF_PWM_PIN
+  analogWrite(DRIVER_VREF_PWM_PIN, 255);
+#endif
+  digitalWrite(STEPPER_ENABLE_PIN, drivers_enabled ? LOW : HIGH);
 }
 
 // ================================================================
@@ -200,6 +694,54 @@ void stepper_output_interrupt(void)
   y_axis.pollForInterval(interval);
   z_axis.pollForInterval(interval);
   a_axis.pollForInterval(interval);
+
+#if defined(PCINT0_vect)
+  // Resample any limit input which changed during its debounce interval.
+  x_monitor.pollDeferred();
+  y_monitor.pollDeferred();
+  z_monitor.pollDeferred();
+#else
+  // Without pin-change interrupts, sample the limit inputs at the step rate.
+  x_monitor.pollLimit();
+  y_monitor.pollLimit();
+  z_monitor.pollLimit();
+#endif
+}
+
+#if defined(PCINT0_vect)
+// ================================================================
+/// Pin-change interrupt handler for the limit inputs, which all lie on port B.
+/// Runs at the same priority as the stepper timer interrupt, so the latched
+/// step counts are consistent.
+ISR(PCINT0_vect)
+{
+  x_monitor.pollLimit();
+  y_monitor.pollLimit();
+  z_monitor.pollLimit();
+}
+#endif
+
+#if USE_ENCODERS && defined(PCINT1_vect)
+// ================================================================
+/// Pin-change interrupt handler for the encoder inputs on port C.
+ISR(PCINT1_vect)
+{
+  x_monitor.updateEncoder(digitalRead(X_ENCODER_A_PIN), digitalRead(X_ENCODER_B_PIN));
+  y_monitor.updateEncoder(digitalRead(Y_ENCODER_A_PIN), digitalRead(Y_ENCODER_B_PIN));
+}
+#endif
+
+// ================================================================
+/// Configure an input pin with pull-up and enable its pin-change interrupt
+/// if the processor supports them.
+static void enable_pin_change_input(uint8_t pin)
+{
+  pinMode(pin, INPUT_PULLUP);
+#if defined(PCICR)
+  *digitalPinToPCMSK(pin) |= bit(digitalPinToPCMSKbit(pin));
+  PCIFR |= bit(digitalPinToPCICRbit(pin));
+  PCICR |= bit(digitalPinToPCICRbit(pin));
+#endif
 }
 
 // ================================================================
@@ -207,23 +749,53 @@ void stepper_output_interrupt(void)
 /// and update the step generators.
 void path_poll(unsigned long interval)
 {
+  // Hold every path while the drivers are off or waking, so no step is issued
+  // until the motors are energized.  set_driver_enable() and power_poll()
+  // stopped the step generators when this began, so they stay at rest.
+  if (!drivers_enabled) return;
+  if (driver_wake_timer > 0) {
+    driver_wake_timer -= interval;
+    return;
+  }
+
+  // Splines and oscillators drive the references and targets before the paths
+  // are integrated.  Stored gestures top up the spline buffers first.
+#if USE_SPLINES
+  gestures.poll();
+
+  x_spline.pollForInterval(interval);
+  y_spline.pollForInterval(interval);
+  z_spline.pollForInterval(interval);
+  a_spline.pollForInterval(interval);
+#endif
+
+#if USE_OSCILLATORS
+  x_oscillator.pollForInterval(interval);
+  y_oscillator.pollForInterval(interval);
+  z_oscillator.pollForInterval(interval);
+  a_oscillator.pollForInterval(interval);
+#endif
+
   x_path.pollForInterval(interval);
   y_path.pollForInterval(interval);
   z_path.pollForInterval(interval);
   a_path.pollForInterval(interval);
 
-  // update the step generator for new targets
-  x_axis.setTarget(x_path.currentPosition());
-  x_axis.setSpeed(abs(x_path.currentVelocity()));
+  // Update the step generators with new fixed-point position and velocity
+  // setpoints.  The fractional part is retained and the velocity is fed
+  // forward so each step generator extrapolates the path between updates; the
+  // speed setting only limits the rate at which any remaining error is taken up.
+  x_axis.setTrajectory(x_path.currentPositionFixed(STEP_FRACTION_BITS), x_path.currentVelocityFixed(STEP_FRACTION_BITS));
+  x_axis.setSpeed(x_path.velocityLimit());
 
-  y_axis.setTarget(y_path.currentPosition());
-  y_axis.setSpeed(abs(y_path.currentVelocity()));
+  y_axis.setTrajectory(y_path.currentPositionFixed(STEP_FRACTION_BITS), y_path.currentVelocityFixed(STEP_FRACTION_BITS));
+  y_axis.setSpeed(y_path.velocityLimit());
 
-  z_axis.setTarget(z_path.currentPosition());
-  z_axis.setSpeed(abs(z_path.currentVelocity()));
+  z_axis.setTrajectory(z_path.currentPositionFixed(STEP_FRACTION_BITS), z_path.currentVelocityFixed(STEP_FRACTION_BITS));
+  z_axis.setSpeed(z_path.velocityLimit());
 
-  a_axis.setTarget(a_path.currentPosition());
-  a_axis.setSpeed(abs(a_path.currentVelocity()));
+  a_axis.setTrajectory(a_path.currentPositionFixed(STEP_FRACTION_BITS), a_path.currentVelocityFixed(STEP_FRACTION_BITS));
+  a_axis.setSpeed(a_path.velocityLimit());
 }
 // ================================================================
 /// Return a Path object or NULL for each flag in the flag token.  As a side effect, updates
@@ -245,148 +817,750 @@ static Path *path_flag_iterator(char **tokenptr)
 }
 
 // ================================================================
-/// Process an input message.  Unrecognized commands are silently ignored.
+/// Return an AxisMonitor object or NULL for each flag in the flag token.  As a
+/// side effect, updates the source pointer, leaving it at the terminating null.
+static AxisMonitor *monitor_flag_iterator(char **tokenptr)
+{
+  char flag = **tokenptr;
+  if (flag == 0) return NULL;
+  else {
+    (*tokenptr) += 1;
+    switch (flag) {
+    case 'x': return &x_monitor;
+    case 'y': return &y_monitor;
+    case 'z': return &z_monitor;
+    case 'a': return &a_monitor;
+    default: return NULL;
+    }
+  }
+}
+
+// ================================================================
+/// Return a Homing object or NULL for each flag in the flag token.  As a side
+/// effect, updates the source pointer, leaving it at the terminating null.
+static Homing *homing_flag_iterator(char **tokenptr)
+{
+  char flag = **tokenptr;
+  if (flag == 0) return NULL;
+  else {
+    (*tokenptr) += 1;
+    switch (flag) {
+    case 'x': return &x_homing;
+    case 'y': return &y_homing;
+    case 'z': return &z_homing;
+    case 'a': return &a_homing;
+    default: return NULL;
+    }
+  }
+}
+
+// ================================================================
+/// Return a PositionReport object or NULL for each flag in the flag token.  As
+/// a side effect, it advances the pointer to the next flag.
+static PositionReport *report_flag_iterator(char **tokenptr)
+{
+  char flag = **tokenptr;
+  if (flag == 0) return NULL;
+  else {
+    (*tokenptr) += 1;
+    switch (flag) {
+    case 'x': return &x_report;
+    case 'y': return &y_report;
+    case 'z': return &z_report;
+    case 'a': return &a_report;
+    default: return NULL;
+    }
+  }
+}
+
+#if USE_OSCILLATORS
+// ================================================================
+/// Return an Oscillator object or NULL for each flag in the flag token.  As a
+/// side effect, it advances the pointer to the next flag.
+static Oscillator *oscillator_flag_iterator(char **tokenptr)
+{
+  char flag = **tokenptr;
+  if (flag == 0) return NULL;
+  else {
+    (*tokenptr) += 1;
+    switch (flag) {
+    case 'x': return &x_oscillator;
+    case 'y': return &y_oscillator;
+    case 'z': return &z_oscillator;
+    case 'a': return &a_oscillator;
+    default: return NULL;
+    }
+  }
+}
+
+// ================================================================
+/// Return the Oscillator::Waveform named by a token, or -1 if none.
+static int parse_waveform(const char *token)
+{
+  if (!strcmp_P(token, PSTR("sine")))  return Oscillator::SINE;
+  if (!strcmp_P(token, PSTR("tri")))   return Oscillator::TRIANGLE;
+  if (!strcmp_P(token, PSTR("noise"))) return Oscillator::NOISE;
+  return -1;
+}
+#endif
+
+#if USE_SPLINES
+// ================================================================
+/// Return a Spline object or NULL for each flag in the flag token.  As a side
+/// effect, it advances the pointer to the next flag.
+static Spline *spline_flag_iterator(char **tokenptr)
+{
+  char flag = **tokenptr;
+  if (flag == 0) return NULL;
+  else {
+    (*tokenptr) += 1;
+    switch (flag) {
+    case 'x': return &x_spline;
+    case 'y': return &y_spline;
+    case 'z': return &z_spline;
+    case 'a': return &a_spline;
+    default: return NULL;
+    }
+  }
+}
+
+// ================================================================
+/// Return the Spline object driving a Path object.
+static Spline *path_spline(Path *p)
+{
+  if (p == &x_path) return &x_spline;
+  if (p == &y_path) return &y_spline;
+  if (p == &z_path) return &z_spline;
+  return &a_spline;
+}
+#endif
+
+// ================================================================
+/// Validate a flag token.  Returns the number of axes named, or zero if the
+/// token contains any character other than the axis letters or names an axis
+/// more than once.
+static int flag_count(const char *flags)
+{
+  uint8_t seen = 0;
+  int count = 0;
+  for (; *flags; flags++) {
+    const char *axis = strchr_P(axis_letters, *flags);
+    if (axis == NULL) return 0;
+    uint8_t mask = 1 << (axis - axis_letters);
+    if (seen & mask) return 0;
+    seen |= mask;
+    count++;
+  }
+  return count;
+}
+
+// ================================================================
+/// Validate a motion command of the form '<command> <flags> <value>+' with
+/// exactly one integer value per axis.  On success the values are stored in
+/// flag order and the axis count is returned; otherwise a debugging message is
+/// sent and zero is returned.
+static int parse_axis_values(int argc, char *argv[], NumberScanner argn[], long values[])
+{
+  int count = (argc > 1) ? flag_count(argv[1]) : 0;
+  if (count == 0 || argc != count + 2) {
+    send_error_message(F("invalid arguments"));
+    return 0;
+  }
+  for (int i = 0; i < count; i++) {
+    if (!argn[i+2].toLong(&values[i])) {
+      send_error_message(F("invalid arguments"));
+      return 0;
+    }
+  }
+  return count;
+}
+
+// ================================================================
+/// Return true if the command is one of the per-axis motion commands which
+/// take one integer argument per flag: a, d, r, v, s, w or, with splines, k.
+static bool is_motion_command(const char *command)
+{
+#if USE_SPLINES
+  const char *commands = PSTR("adrvswk");
+#else
+  const char *commands = PSTR("adrvsw");
+#endif
+  return command[0] != 0 && command[1] == 0 && strchr_P(commands, command[0]) != NULL;
+}
+
+// ================================================================
+/// Report the result of a homing cycle which has just finished.
+static void homing_report(Homing *h, char axis)
+{
+  if (h->currentState() == Homing::DONE) send_message(F("homed"), axis, h->switchOffset());
+  else send_message(F("homefail"), axis, (long) h->failedState());
+}
+
+// ================================================================
+/// Cancel any homing cycle running on the flagged axes, reporting each as
+/// failed.  A command which drives an axis takes over from its homing cycle.
+static void cancel_homing(char *flags)
+{
+  while (*flags) {
+    char axis = *flags;
+    Homing *h = homing_flag_iterator(&flags);
+    if (h->cancel()) homing_report(h, axis);
+  }
+}
+
+// ================================================================
+/// Apply one axis value of a motion command to its path generator.
+static void apply_motion(char command, Path *p, long value)
+{
+#if USE_SPLINES
+  // A new position or velocity takes over from any spline playback.
+  if (strchr_P(PSTR("adwv"), command) != NULL) path_spline(p)->stop();
+#endif
+
+  switch (command) {
+  case 'a': p->setTarget(value);          break;
+  case 'w': p->addWaypoint(value);        break;
+#if USE_SPLINES
+  case 'k': path_spline(p)->addPoint(value); break;
+#endif
+  case 'd': p->incrementTarget(value);    break;
+  case 'r': p->incrementReference(value); break;
+  case 'v': p->setVelocity(value);        break;
+  case 's': p->setSpeed(value);           break;
+  }
+}
+
+// ================================================================
+/// Apply a validated motion command: one value per flag, in flag order.  Only
+/// the commands which move an axis enable the drivers.  While a gesture is
+/// being stored, 'k' points are written to the gesture instead of played.
+/// Waypoints and spline points are queued on every channel or on none.
+static void motion_command(char command, char *flags, int count, long values[])
+{
+#if USE_SPLINES
+  if (command == 'k' && gestures.isStoring()) {
+    if (count != gestures.storeChannels()) send_error_message(F("invalid arguments"));
+    else if (!gestures.storePoint(values)) send_error_message(F("gesture storage full or step too large"));
+    return;
+  }
+#endif
+  char *check = flags;
+  for (int i = 0; i < count; i++) {
+    Path *p = path_flag_iterator(&check);
+    if (command == 'w' && p->pendingWaypoints() == PATH_WAYPOINTS) {
+      send_error_message(F("waypoint queue full"));
+      return;
+    }
+#if USE_SPLINES
+    if (command == 'k' && !path_spline(p)->accepts(values[i])) {
+      send_error_message(F("spline buffer full or step too large"));
+      return;
+    }
+#endif
+  }
+  if (strchr_P(PSTR("adrvwk"), command) != NULL) {
+    cancel_homing(flags);
+    set_driver_enable(1);
+  }
+  for (int i = 0; i < count; i++) apply_motion(command, path_flag_iterator(&flags), values[i]);
+}
+
+// ================================================================
+/// Add a time-tagged command to the schedule queue, after any command with an
+/// earlier or equal time.  Returns false if the queue is full or the command
+/// is too long.
+static bool schedule_command(unsigned long time, int argc, char *argv[])
+{
+  if (schedule_count == SCHEDULE_SLOTS || argc > MAX_SCHEDULED_TOKENS) return false;
+
+  int length = 0;
+  for (int i = 0; i < argc; i++) length += strlen(argv[i]) + 1;
+  if (length > SCHEDULE_LENGTH) return false;
+
+  // Move later commands up one slot; the signed difference handles wraparound of the clock.
+  uint8_t position = schedule_count;
+  while (position > 0) {
+    uint8_t previous = (schedule_head + position - 1) % SCHEDULE_SLOTS;
+    if ((long) (schedule[previous].time - time) <= 0) break;
+    schedule[(schedule_head + position) % SCHEDULE_SLOTS] = schedule[previous];
+    position--;
+  }
+
+  uint8_t slot = (schedule_head + position) % SCHEDULE_SLOTS;
+  char *dest = schedule[slot].tokens;
+  for (int i = 0; i < argc; i++) {
+    int len = strlen(argv[i]) + 1;
+    memcpy(dest, argv[i], len);
+    dest += len;
+  }
+  schedule[slot].time = time;
+  schedule[slot].argc = argc;
+  schedule_count++;
+  return true;
+}
+
+// ================================================================
+/// Process an input message.  Unrecognized commands are reported.  A
+/// recognized command with a malformed flag token, the wrong number of
+/// arguments, or a non-numeric argument is rejected as a whole with a
+/// debugging message.  Motion commands arriving over the serial port are
+/// normally scanned through stream_argument() instead; this path handles
+/// them when scheduled with 'at' or when the flags are invalid.
 ///
 /// @param argc		number of argument tokens
 /// @param argv		array of pointers to strings, one per token
-void parse_input_message(int argc, char *argv[])
+/// @param argn		array of numeric scanners, one per token, already fed the token text
+void parse_input_message(int argc, char *argv[], NumberScanner argn[])
 {
   if (argc == 0) return;
 
   // Interpret the first token as a command symbol.
   char *command = argv[0];
 
-  if (string_equal(command, "enable")) {
-    if (argc > 1) set_driver_enable(atoi(argv[1]));
+  // Values for the per-axis motion commands.  Each command is validated in
+  // full before any state is changed, so a malformed line has no effect.
+  long values[NUM_AXES];
+  int count;
 
-  } else if (string_equal(command, "a")) {
-    if (argc > 2) {
-      set_driver_enable(1);
+  if (string_equal(command, PSTR("enable"))) {
+    long value;
+    if (argc == 2 && argn[1].toLong(&value)) set_driver_enable(value != 0);
+    else send_error_message(F("invalid arguments"));
+
+  } else if (is_motion_command(command)) {
+    if ((count = parse_axis_values(argc, argv, argn, values)) > 0) motion_command(command[0], argv[1], count, values);
+  } else if (string_equal(command, PSTR("g"))) {
+    float frequency, damping_ratio;
+    if (argc == 4 && flag_count(argv[1]) > 0 && argn[2].toFloat(&frequency) && argn[3].toFloat(&damping_ratio)) {
       char *flags = argv[1];
-      int channel = 0;
-      while (*flags) {
-	Path *p = path_flag_iterator(&flags);
-	if (p) {
-	  if (argc > (channel+2)) {
-	    p->setTarget(atol(argv[channel+2]));
-	    channel++;
-	  }
-	}
+      while (*flags) path_flag_iterator(&flags)->setFreqDamping(frequency, damping_ratio);
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("l"))) {
+    float qdmax, qddmax;
+    if (argc == 4 && flag_count(argv[1]) > 0 && argn[2].toFloat(&qdmax) && argn[3].toFloat(&qddmax)
+	&& qdmax > 0 && qddmax > 0) {
+      if (qdmax > MAX_STEP_RATE) send_error_message(F("velocity above maximum step rate"));
+      else {
+	char *flags = argv[1];
+	while (*flags) path_flag_iterator(&flags)->setLimits(qdmax, qddmax);
       }
-    }
-  } else if (string_equal(command, "d")) {
-    if (argc > 2) {
-      set_driver_enable(1);
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("index"))) {
+    long tolerance;
+    if (argc == 3 && flag_count(argv[1]) > 0 && argn[2].toLong(&tolerance)) {
       char *flags = argv[1];
-      int channel = 0;
-      while (*flags) {
-	Path *p = path_flag_iterator(&flags);
-	if (p) {
-	  if (argc > (channel+2)) {
-	    p->incrementTarget(atol(argv[channel+2]));
-	    channel++;
-	  }
-	}
-      }
-    }
-  } else if (string_equal(command, "r")) {
-    if (argc > 2) {
+      while (*flags) monitor_flag_iterator(&flags)->setCorrection(tolerance >= 0, tolerance);
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("home"))) {
+    if (argc == 2 && flag_count(argv[1]) > 0) {
       set_driver_enable(1);
-      char *flags = argv[1];
-      int channel = 0;
+      char *flags;
+#if USE_OSCILLATORS
+      flags = argv[1];
+      while (*flags) oscillator_flag_iterator(&flags)->stop();
+#endif
+#if USE_SPLINES
+      flags = argv[1];
+      while (*flags) spline_flag_iterator(&flags)->stop();
+#endif
+      flags = argv[1];
       while (*flags) {
-	Path *p = path_flag_iterator(&flags);
-	if (p) {
-	  if (argc > (channel+2)) {
-	    p->incrementReference(atol(argv[channel+2]));
-	    channel++;
-	  }
-	}
+	if (!homing_flag_iterator(&flags)->begin()) send_error_message(F("no limit switch"));
       }
-    }
-  } else if (string_equal(command, "v")) {
-    if (argc > 2) {
+    } else send_error_message(F("invalid arguments"));
+
+#if USE_SPLINES
+  } else if (string_equal(command, PSTR("spline"))) {
+    long segment;
+    if (argc == 3 && flag_count(argv[1]) > 0 && argn[2].toLong(&segment) && segment > 0 && segment <= MAX_SPLINE_SEGMENT) {
+      char *flags = argv[1];
+      while (*flags) spline_flag_iterator(&flags)->reset(1000 * segment);
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("store"))) {
+    long id, segment;
+    if (argc == 2 && string_equal(argv[1], PSTR("end"))) {
+      if (gestures.endStore()) send_message(F("stored"), gestures.freeSpace());
+      else send_error_message(F("too few gesture points"));
+    } else if (argc == 4 && argn[1].toLong(&id) && id >= 0 && id <= GESTURE_MAX_ID && flag_count(argv[2]) > 0
+	       && argn[3].toLong(&segment) && segment > 0 && segment <= MAX_SPLINE_SEGMENT) {
+      if (!gestures.beginStore(id, flag_count(argv[2]), segment)) send_error_message(F("gesture storage full"));
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("erase"))) {
+    long id;
+    if (argc == 2 && string_equal(argv[1], PSTR("all"))) gestures.eraseAll();
+    else if (argc == 2 && argn[1].toLong(&id) && id >= 0 && id <= GESTURE_MAX_ID) {
+      if (!gestures.erase(id)) send_error_message(F("no such gesture"));
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("gestures"))) {
+    int address = 0;
+    uint8_t id, channels;
+    unsigned int points;
+    while (gestures.list(&address, &id, &channels, &points)) send_message(F("gesture"), id, channels, points);
+    send_message(F("free"), gestures.freeSpace());
+
+  } else if (string_equal(command, PSTR("play"))) {
+    long id;
+    if (argc == 3 && argn[1].toLong(&id) && id >= 0 && id <= GESTURE_MAX_ID && (count = flag_count(argv[2])) > 0) {
+      Spline *splines[NUM_AXES];
+      char *flags = argv[2];
+      for (int i = 0; i < count; i++) splines[i] = spline_flag_iterator(&flags);
       set_driver_enable(1);
+      if (!gestures.play(id, splines, count)) send_error_message(F("no such gesture"));
+      else cancel_homing(argv[2]);
+    } else if (argc == 2 && flag_count(argv[1]) > 0) {
+      // Start every channel or none.
+      char *flags = argv[1];
+      bool ready = true;
+      while (*flags) ready = spline_flag_iterator(&flags)->isReady() && ready;
+      if (ready) {
+	cancel_homing(argv[1]);
+	set_driver_enable(1);
+	flags = argv[1];
+	while (*flags) spline_flag_iterator(&flags)->start();
+      } else send_error_message(F("too few spline points"));
+    } else send_error_message(F("invalid arguments"));
+
+#endif
+  } else if (string_equal(command, PSTR("report"))) {
+    long deadband;
+    if (argc == 3 && flag_count(argv[1]) > 0 && string_equal(argv[2], PSTR("off"))) {
+      char *flags = argv[1];
+      while (*flags) report_flag_iterator(&flags)->setDeadband(-1);
+    } else if (argc == 3 && flag_count(argv[1]) > 0 && argn[2].toLong(&deadband) && deadband >= 0) {
+      char *flags = argv[1];
+      while (*flags) report_flag_iterator(&flags)->setDeadband(deadband);
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("settle"))) {
+    float tolerance, speed, dwell;
+    if (argc == 3 && flag_count(argv[1]) > 0 && string_equal(argv[2], PSTR("off"))) {
       char *flags = argv[1];
-      int channel = 0;
+      while (*flags) path_flag_iterator(&flags)->setSettling(-1.0, 0.0, 0.0);
+    } else if (argc == 5 && flag_count(argv[1]) > 0 && argn[2].toFloat(&tolerance) && argn[3].toFloat(&speed)
+	       && argn[4].toFloat(&dwell) && tolerance >= 0.0 && speed >= 0.0 && dwell >= 0.0) {
+      char *flags = argv[1];
+      while (*flags) path_flag_iterator(&flags)->setSettling(tolerance, speed, 0.001 * dwell);
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("limit"))) {
+    long lower, upper;
+    if (argc == 3 && flag_count(argv[1]) > 0 && string_equal(argv[2], PSTR("off"))) {
+      char *flags = argv[1];
+      while (*flags) path_flag_iterator(&flags)->setPositionLimits(-INFINITY, INFINITY);
+    } else if (argc == 4 && flag_count(argv[1]) > 0 && argn[2].toLong(&lower) && argn[3].toLong(&upper) && lower <= upper) {
+      // Limits which exclude an axis would drive it to the nearest limit
+      // without a motion command, so the whole line is rejected instead.
+      char *flags = argv[1];
+      bool inside = true;
       while (*flags) {
-	Path *p = path_flag_iterator(&flags);
-	if (p) {
-	  if (argc > (channel+2)) {
-	    p->setVelocity(atol(argv[channel+2]));
-	    channel++;
-	  }
-	}
+	long position = path_flag_iterator(&flags)->currentPosition();
+	if (position < lower || position > upper) inside = false;
       }
-    }
-  } else if (string_equal(command, "s")) {
-    if (argc > 2) {
+      if (!inside) send_error_message(F("position outside limits"));
+      else {
+	flags = argv[1];
+	while (*flags) path_flag_iterator(&flags)->setPositionLimits(lower, upper);
+      }
+    } else send_error_message(F("invalid arguments"));
+
+#if USE_OSCILLATORS
+  } else if (string_equal(command, PSTR("osc"))) {
+    int waveform;
+    long amplitude;
+    float frequency, phase_step, attack;
+    if (argc == 7 && flag_count(argv[1]) > 0 && (waveform = parse_waveform(argv[2])) >= 0
+	&& argn[3].toLong(&amplitude) && argn[4].toFloat(&frequency)
+	&& frequency >= 0.0 && frequency <= MAX_OSCILLATOR_FREQUENCY
+	&& argn[5].toFloat(&phase_step) && argn[6].toFloat(&attack) && attack >= 0.0) {
+      // All channels of one command share a noise sequence, so a noise ripple
+      // is one gesture passing across the axes.
+      static uint32_t seed = 0;
+      seed += 0x9e3779b9UL;
+      cancel_homing(argv[1]);
       set_driver_enable(1);
       char *flags = argv[1];
-      int channel = 0;
-      while (*flags) {
-	Path *p = path_flag_iterator(&flags);
-	if (p) {
-	  if (argc > (channel+2)) {
-	    p->setSpeed(atol(argv[channel+2]));
-	    channel++;
-	  }
-	}
-      }
-    }
-  } else if (string_equal(command, "g")) {
-    if (argc > 3) {
+      for (int i = 0; *flags; i++)
+	oscillator_flag_iterator(&flags)->start((Oscillator::Waveform) waveform, amplitude, frequency, -i * phase_step / 360.0, attack, seed);
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("release"))) {
+    float seconds;
+    if (argc == 3 && flag_count(argv[1]) > 0 && argn[2].toFloat(&seconds) && seconds >= 0.0) {
       char *flags = argv[1];
-      float frequency = atof(argv[2]);
-      float damping_ratio = atof(argv[3]);
-      while (*flags) {
-	Path *p = path_flag_iterator(&flags);
-	if (p) p->setFreqDamping(frequency, damping_ratio);
-      }
-    }
-  } else if (string_equal(command, "l")) {
-    if (argc > 3) {
+      while (*flags) oscillator_flag_iterator(&flags)->release(seconds);
+    } else send_error_message(F("invalid arguments"));
+
+#endif
+  } else if (string_equal(command, PSTR("encoder"))) {
+    long steps, counts, tolerance = -1;
+    if ((argc == 4 || (argc == 5 && argn[4].toLong(&tolerance) && tolerance >= 0))
+	&& flag_count(argv[1]) > 0 && argn[2].toLong(&steps) && argn[3].toLong(&counts)) {
       char *flags = argv[1];
-      float qdmax = atof(argv[2]);
-      float qddmax = atof(argv[3]);
-      while (*flags) {
-	Path *p = path_flag_iterator(&flags);
-	if (p) p->setLimits(qdmax, qddmax);
-      }
-    }
-  } else if (string_equal(command, "version")) {
-    send_message(version_string);
-
-  } else if (string_equal(command, "ping")) {
-    send_message("awake");
-
-  } else if (string_equal(command, "srate")) {
-    if (argc > 1) {
-      long value = atol(argv[1]);
-      // set the reporting interval (milliseconds -> microseconds)
-      if (value > 0)  status_poll_interval = 1000*value;
-      else send_debug_message("invalid srate value");
-    }
+      while (*flags) monitor_flag_iterator(&flags)->setEncoderScale(steps, counts, tolerance);
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("version"))) {
+    send_message((const __FlashStringHelper *) version_string);
+
+  } else if (string_equal(command, PSTR("ping"))) {
+    send_message(F("awake"));
+
+  } else if (string_equal(command, PSTR("clock"))) {
+    send_message(F("clock"), sync_clock.now(micros()));
+
+  } else if (string_equal(command, PSTR("sync"))) {
+    unsigned long board, host, delay = 0;
+    if ((argc == 3 || (argc == 4 && argn[3].toULong(&delay))) && argn[1].toULong(&board) && argn[2].toULong(&host)) {
+      sync_clock.synchronize(micros(), board, host, delay);
+      send_message(F("sync"), sync_clock.lastError(), sync_clock.rateTrimPPB());
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("at"))) {
+    // Nested time tags are not allowed.
+    unsigned long time;
+    if (argc > 2 && argn[1].toULong(&time) && !string_equal(argv[2], PSTR("at"))) {
+      if (!schedule_command(time, argc-2, argv+2))
+	send_error_message(F("schedule full"));
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("baud"))) {
+    unsigned long rate;
+    if (!(argc == 2 && argn[1].toULong(&rate) && serial_baud_request(rate)))
+      send_error_message(F("invalid baud rate"));
+
+  } else if (string_equal(command, PSTR("save"))) {
+    if (argc == 1) save_config();
+    else if (argc == 2 && string_equal(argv[1], PSTR("clear"))) config_clear();
+    else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("load"))) {
+    if (!load_config()) send_error_message(F("no saved configuration"));
+
+  } else if (string_equal(command, PSTR("power"))) {
+    long idle, percent;
+    if (argc == 3 && argn[1].toLong(&idle) && idle >= 0 && idle <= 1800000L
+	&& argn[2].toLong(&percent) && percent >= 0 && percent <= 100) {
+      driver_idle_time = 1000 * idle;
+      driver_hold_level = (255 * percent + 50) / 100;
+      driver_idle_timer = driver_idle_time;
+    } else send_error_message(F("invalid arguments"));
+
+  } else if (string_equal(command, PSTR("srate"))) {
+    long value;
+    // set the reporting interval (milliseconds -> microseconds)
+    if (argc == 2 && argn[1].toLong(&value) && value > 0 && value < 4000000L) status_poll_interval = 1000*value;
+    else send_error_message(F("invalid srate value"));
+
+  } else send_error_message(F("unrecognized command"));
+}
+
+/****************************************************************/
+/// State of a motion command whose arguments are scanned as they arrive.
+static char stream_command;                 ///< command letter
+static char *stream_flags;                  ///< flag token, still held in the input buffer
+static long stream_values[NUM_AXES];        ///< value for each flag, in order
+static int stream_count;                    ///< number of flags
+
+/****************************************************************/
+/// Called by the tokenizer once the command and flag tokens of a message are
+/// complete.  Returns true if this is a motion command with valid flags, in
+/// which case the arguments will be passed to stream_argument() one at a time.
+bool stream_begin(char *command, char *flags)
+{
+  if (!is_motion_command(command) || (stream_count = flag_count(flags)) == 0) return false;
+  stream_command = command[0];
+  stream_flags = flags;
+  return true;
+}
+
+/****************************************************************/
+/// Called by the tokenizer as each argument of a streamed motion command
+/// ends, with the zero-based argument index.  The value is only checked and
+/// kept; nothing is applied until stream_end().  Returns false and reports an
+/// error if the argument is not an integer or there are more arguments than
+/// flags, in which case the rest of the line is ignored.
+bool stream_argument(int index, NumberScanner *number)
+{
+  if (index >= stream_count || !number->toLong(&stream_values[index])) {
+    send_error_message(F("invalid arguments"));
+    return false;
   }
+  return true;
+}
+
+/****************************************************************/
+/// Called by the tokenizer at the end of a streamed motion command with the
+/// number of arguments received.  Applies all the values together, or reports
+/// an error and applies none if any were missing.
+void stream_end(int count)
+{
+  if (count != stream_count) send_error_message(F("invalid arguments"));
+  else motion_command(stream_command, stream_flags, stream_count, stream_values);
 }
 
 /****************************************************************/
-/// Polling function to send status reports at periodic intervals.
+/// Polling function to execute time-tagged commands once the disciplined clock
+/// reaches their start time.  Commands are executed in time order, and those
+/// with equal times in arrival order.
+static void schedule_poll(void)
+{
+  if (schedule_count == 0) return;
+
+  // The signed difference handles wraparound of the clock.
+  unsigned long now = sync_clock.now(micros());
+  if ((long) (now - schedule[schedule_head].time) < 0) return;
+
+  // Rebuild the token array from the stored tokens and rescan the numbers.
+  char *argv[MAX_SCHEDULED_TOKENS];
+  NumberScanner argn[MAX_SCHEDULED_TOKENS];
+  char *token = schedule[schedule_head].tokens;
+  int argc = schedule[schedule_head].argc;
+  for (int i = 0; i < argc; i++) {
+    argv[i] = token;
+    argn[i].scan(token);
+    token += strlen(token) + 1;
+  }
+
+  schedule_head = (schedule_head + 1) % SCHEDULE_SLOTS;
+  schedule_count--;
+
+  parse_detached_message(argc, argv, argn);
+}
+
+/****************************************************************/
+/// Polling function to run the encoder checks and report any step
+/// corrections made by the monitors.
+static void monitor_poll(void)
+{
+  long lost;
+  if ((lost = x_monitor.poll()) != 0) send_message(F("lost"), 'x', lost);
+  if ((lost = y_monitor.poll()) != 0) send_message(F("lost"), 'y', lost);
+  if ((lost = z_monitor.poll()) != 0) send_message(F("lost"), 'z', lost);
+  if ((lost = a_monitor.poll()) != 0) send_message(F("lost"), 'a', lost);
+}
+
+/****************************************************************/
+/// Return true if a channel is being driven or is still moving.
+static bool channel_active(Path *p, Homing *h)
+{
+  return p->currentVelocity() != 0 || p->pendingWaypoints() > 0 || h->isActive();
+}
+
+/****************************************************************/
+/// Return true if any spline or oscillator is driving a channel.
+static bool modulation_active(void)
+{
+#if USE_SPLINES
+  if (x_spline.isActive() || y_spline.isActive() || z_spline.isActive() || a_spline.isActive()) return true;
+#endif
+#if USE_OSCILLATORS
+  if (x_oscillator.isActive() || y_oscillator.isActive() || z_oscillator.isActive() || a_oscillator.isActive()) return true;
+#endif
+  return false;
+}
+
+/****************************************************************/
+/// Polling function to reduce driver power once every channel has been at
+/// rest for the idle time.
+static void power_poll(unsigned long interval)
+{
+  static long last_x = 0, last_y = 0, last_z = 0, last_a = 0;
+  long x = x_axis.currentPosition();
+  long y = y_axis.currentPosition();
+  long z = z_axis.currentPosition();
+  long a = a_axis.currentPosition();
+  bool moved = (x != last_x) || (y != last_y) || (z != last_z) || (a != last_a);
+  last_x = x; last_y = y; last_z = z; last_a = a;
+
+  if (!drivers_enabled || drivers_holding || driver_idle_time == 0) return;
+
+  if (moved
+      || modulation_active()
+      || channel_active(&x_path, &x_homing)
+      || channel_active(&y_path, &y_homing)
+      || channel_active(&z_path, &z_homing)
+      || channel_active(&a_path, &a_homing)) {
+    driver_idle_timer = driver_idle_time;
+    return;
+  }
+
+  driver_idle_timer -= interval;
+  if (driver_idle_timer >= 0) return;
+
+#ifdef DRIVER_VREF_PWM_PIN
+  if (driver_hold_level > 0) {
+    analogWrite(DRIVER_VREF_PWM_PIN, driver_hold_level);
+    drivers_holding = true;
+    return;
+  }
+#endif
+  drivers_enabled = false;
+  hold_steppers();
+  digitalWrite(STEPPER_ENABLE_PIN, HIGH);
+}
+
+/****************************************************************/
+/// Polling function to report channels which have settled.
+static void settle_poll(void)
+{
+  if (x_path.settleEvent()) send_message(F("done"), 'x', x_axis.currentPosition());
+  if (y_path.settleEvent()) send_message(F("done"), 'y', y_axis.currentPosition());
+  if (z_path.settleEvent()) send_message(F("done"), 'z', z_axis.currentPosition());
+  if (a_path.settleEvent()) send_message(F("done"), 'a', a_axis.currentPosition());
+}
+
+/****************************************************************/
+/// Polling function to advance any active homing cycles.
+static void homing_poll(void)
+{
+  if (x_homing.poll()) homing_report(&x_homing, 'x');
+  if (y_homing.poll()) homing_report(&y_homing, 'y');
+  if (z_homing.poll()) homing_report(&z_homing, 'z');
+  if (a_homing.poll()) homing_report(&a_homing, 'a');
+}
+
+/****************************************************************/
+/// Sample one channel for report-on-change and send any resulting message.
+static void report_axis(PositionReport *r, char axis, Stepper *s)
+{
+  long position = s->currentPosition();
+  if (r->poll(position)) send_message(F("pos"), axis, position);
+}
+
+/****************************************************************/
+/// Polling function to send status reports at periodic intervals, and
+/// position changes of the channels reporting on change.
 static void status_poll(unsigned long interval)
 {
   static long timer = 0;
+  static long check_timer = 0;
   timer -= interval;
+  check_timer -= interval;
+
+  if (check_timer < 0) {
+    check_timer = REPORT_CHECK_INTERVAL;
+    report_axis(&x_report, 'x', &x_axis);
+    report_axis(&y_report, 'y', &y_axis);
+    report_axis(&z_report, 'z', &z_axis);
+    report_axis(&a_report, 'a', &a_axis);
+  }
 
   if (timer < 0) {
     timer += status_poll_interval;
 
     // send a time and position reading
-    long clock = micros();
+    long clock = sync_clock.now(micros());
     long x = x_axis.currentPosition();
     long y = y_axis.currentPosition();
     long z = z_axis.currentPosition();
     long a = a_axis.currentPosition();
-    send_message("txyza", clock, x, y, z, a);
+    send_message(F("txyza"), clock, x, y, z, a);
   }
 }
 
@@ -415,16 +1589,31 @@ void setup(void)
   pinMode(LED_BUILTIN, OUTPUT);
 #endif
 
+  // set up the limit switch inputs
+  enable_pin_change_input(X_LIMIT_PIN);
+  enable_pin_change_input(Y_LIMIT_PIN);
+  enable_pin_change_input(Z_LIMIT_PIN);
+
+#if USE_ENCODERS
+  enable_pin_change_input(X_ENCODER_A_PIN);
+  enable_pin_change_input(X_ENCODER_B_PIN);
+  enable_pin_change_input(Y_ENCODER_A_PIN);
+  enable_pin_change_input(Y_ENCODER_B_PIN);
+#endif
+
+  // restore any saved tuning before the host can connect
+  load_config();
+
   // initialize the Serial port
-  Serial.begin(BAUD_RATE);
+  serial_baud_begin(BAUD_RATE);
 
   // set up the timer1 interrupt and attach it to the stepper motor controls
   last_interrupt_clock = micros();
-  Timer1.initialize(100); // 100 microsecond intervals, e.g. 10kHz
+  Timer1.initialize(STEPPER_PERIOD); // 100 microsecond intervals, e.g. 10kHz
   Timer1.attachInterrupt(stepper_output_interrupt);
 
   // send a wakeup message
-  send_message("awake");
+  send_message(F("awake"));
 }
 
 /****************************************************************/
@@ -443,9 +1632,16 @@ void loop(void)
   unsigned long interval = now - last_event_loop;
   last_event_loop = now;
 
+  // Time-tagged commands are checked first to minimize start latency.
+  schedule_poll();
   serial_input_poll();
+  serial_baud_poll();
   status_poll(interval);
+  homing_poll();
   path_poll(interval);
+  settle_poll();
+  power_poll(interval);
+  monitor_poll();
 
   // other polled tasks can go here
 }
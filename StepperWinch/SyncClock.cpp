@@ -0,0 +1,177 @@
+/// \file SyncClock.cpp
+/// \brief Disciplined time base for synchronizing several boards to a host clock.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#include "SyncClock.h"
+
+// Offsets larger than this many microseconds step the clock outright and
+// restart the frequency estimate.
+#define SYNC_STEP_THRESHOLD 10000
+
+// Largest frequency correction accepted, as a fraction.  Ceramic resonators
+// are typically within +/-0.5%, crystals within 50 ppm.
+#define SYNC_RATE_LIMIT 0.005
+
+// Number of exchanges in each group, of which only the one with the
+// shortest round-trip delay is used.  Half the excess delay of an exchange
+// can appear as offset error.
+#define SYNC_GROUP 8
+
+// Samples older than this many microseconds (about 18 minutes) are dropped,
+// which keeps the time differences within range of a long.
+#define SYNC_MAX_AGE 0x40000000UL
+
+// Number of samples needed before the frequency is estimated.
+#define SYNC_MIN_SAMPLES 3
+
+// Reciprocal of the fraction of each new frequency estimate applied to the
+// trim once the history is full.
+#define SYNC_RATE_FILTER 8
+
+//================================================================
+SyncClock::SyncClock()
+{
+  base_local   = 0;
+  base_synced  = 0;
+  last_sync    = 0;
+  rate_trim    = 0.0;
+  last_error   = 0;
+  locked       = 0;
+  acquiring    = 0;
+  sample_head  = 0;
+  sample_count = 0;
+  group_count  = 0;
+  group_delay  = 0;
+  group_local  = 0;
+  group_offset = 0;
+}
+
+//================================================================
+unsigned long SyncClock::now(unsigned long local)
+{
+  // The interval is computed with unsigned arithmetic so that wraparound of
+  // micros() is handled correctly.
+  unsigned long elapsed = local - base_local;
+
+  // Keep the interval short enough that the float correction stays precise.
+  if (elapsed > 0x40000000UL) {
+    base_synced += elapsed + (long) (elapsed * rate_trim);
+    base_local = local;
+    elapsed = 0;
+  }
+  return base_synced + elapsed + (long) (elapsed * rate_trim);
+}
+
+//================================================================
+void SyncClock::synchronize(unsigned long local, unsigned long synced, unsigned long reference, unsigned long delay)
+{
+  long error = (long) (reference - synced);
+  last_error = error;
+
+  // The local time at which the disciplined clock read 'synced', found by
+  // running the present model backwards.
+  long age = (long) (now(local) - synced);
+  unsigned long sampled = local - (age - (long) (age * rate_trim));
+  long offset = (long) (reference - sampled);
+
+  // Forget samples too old to compare; after a long silence forget them all.
+  if (local - last_sync > SYNC_MAX_AGE) sample_count = 0;
+  while (sample_count > 0 && local - sample_local[sample_head] > SYNC_MAX_AGE) {
+    sample_head = (sample_head + 1) % SYNC_HISTORY;
+    sample_count--;
+  }
+  last_sync = local;
+
+  if (!locked || abs(error) > SYNC_STEP_THRESHOLD) {
+    // Coarse correction: step the clock and restart the frequency estimate.
+    // The sample is not kept, as it may have been delayed by other traffic.
+    base_synced = now(local) + error;
+    base_local  = local;
+    rate_trim = 0.0;
+    sample_count = 0;
+    group_count = 0;
+    locked = 1;
+    acquiring = 1;
+    return;
+  }
+
+  // Keep the fastest exchange of each group, which has the most symmetric
+  // timing; the latest wins a tie so that without delays every group
+  // contributes its last sample.  While acquiring, every exchange is used so
+  // that a fast or slow resonator is roughly trimmed before its error
+  // reaches the step threshold.
+  if (group_count == 0 || delay <= group_delay) {
+    group_delay  = delay;
+    group_local  = sampled;
+    group_offset = offset;
+  }
+  if (++group_count < SYNC_GROUP && !acquiring) return;
+  group_count = 0;
+
+  // Append the sample, replacing the oldest if the history is full.
+  uint8_t next = (sample_head + sample_count) % SYNC_HISTORY;
+  sample_local[next]  = group_local;
+  sample_offset[next] = group_offset;
+  if (sample_count < SYNC_HISTORY) sample_count++;
+  else sample_head = (sample_head + 1) % SYNC_HISTORY;
+
+  fit(local);
+
+  // The closely spaced acquisition samples would weigh on the fit long after
+  // their rough trim has been refined, so once it is known they are dropped.
+  if (acquiring && sample_count >= SYNC_MIN_SAMPLES) {
+    acquiring = 0;
+    sample_count = 0;
+  }
+}
+
+//================================================================
+void SyncClock::fit(unsigned long local)
+{
+  // Work relative to the newest sample so the differences stay small.
+  uint8_t newest = (sample_head + sample_count - 1) % SYNC_HISTORY;
+  float mean_x = 0.0, mean_y = 0.0;
+  for (uint8_t i = 0; i < sample_count; i++) {
+    uint8_t k = (sample_head + i) % SYNC_HISTORY;
+    mean_x += (long) (sample_local[k] - sample_local[newest]);
+    mean_y += (long) (sample_offset[k] - sample_offset[newest]);
+  }
+  mean_x /= sample_count;
+  mean_y /= sample_count;
+
+  // The slope of the offset against local time is the frequency error.
+  // Until there are enough samples the present trim is kept.
+  if (sample_count >= SYNC_MIN_SAMPLES) {
+    float sxx = 0.0, sxy = 0.0;
+    for (uint8_t i = 0; i < sample_count; i++) {
+      uint8_t k = (sample_head + i) % SYNC_HISTORY;
+      float dx = (long) (sample_local[k] - sample_local[newest]) - mean_x;
+      float dy = (long) (sample_offset[k] - sample_offset[newest]) - mean_y;
+      sxx += dx * dx;
+      sxy += dx * dy;
+    }
+    if (sxx > 0.0) {
+      float slope = constrain(sxy / sxx, -SYNC_RATE_LIMIT, SYNC_RATE_LIMIT);
+
+      // Once the history is full, each fit only nudges the trim, which
+      // averages over a much longer span than the history itself.
+      if (sample_count == SYNC_HISTORY) rate_trim += (slope - rate_trim) / SYNC_RATE_FILTER;
+      else rate_trim = slope;
+    }
+  }
+
+  // Restart the linear model at the present time on the fitted line.
+  float offset = mean_y + rate_trim * ((long) (local - sample_local[newest]) - mean_x);
+  base_local  = local;
+  base_synced = local + sample_offset[newest] + (long) offset;
+}
+//================================================================
@@ -0,0 +1,83 @@
+/// \file SyncClock.h
+/// \brief Disciplined time base for synchronizing several boards to a host clock.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details This class maintains a microsecond clock derived from the local
+/// micros() counter which is steered to follow a reference clock supplied by
+/// the host.  The host performs a ping/timestamp exchange to measure the offset
+/// between the two clocks and reports it back as a pair of samples, optionally
+/// with the round-trip delay of the exchange.  Large errors are corrected by
+/// stepping the clock.  Otherwise the exchanges are taken in groups and only
+/// the one with the shortest round trip in each group is kept, since delays
+/// from serial latency or a slow polling loop make the timing asymmetric.
+/// The clock is set to the least-squares line through the last several kept
+/// samples: its slope is the frequency trim which compensates the local
+/// crystal skew, and the fit averages out the remaining jitter.  Once the
+/// history is full the trim follows successive fits through a low-gain
+/// filter, so that it keeps improving over minutes of synchronization.
+
+#ifndef __SYNCCLOCK_H_INCLUDED__
+#define __SYNCCLOCK_H_INCLUDED__
+
+#include <stdint.h>
+
+/// Number of reference samples retained for the rate estimate.
+#define SYNC_HISTORY 8
+
+// ================================================================
+class SyncClock {
+
+private:
+  unsigned long base_local;   ///< local micros() value at the base of the linear clock model
+  unsigned long base_synced;  ///< disciplined clock value at base_local
+  unsigned long last_sync;    ///< local micros() value at the most recent synchronize()
+  float rate_trim;            ///< fractional frequency correction, e.g. 1e-5 is +10 ppm
+  long last_error;            ///< most recent measured offset in microseconds
+  uint8_t locked;             ///< true once a reference sample has been applied
+  uint8_t acquiring;          ///< true until the first frequency estimate after a step
+
+  unsigned long sample_local[SYNC_HISTORY];  ///< local micros() value of each retained sample
+  long sample_offset[SYNC_HISTORY];          ///< reference less local time of each retained sample
+  uint8_t sample_head;        ///< index of the oldest retained sample
+  uint8_t sample_count;       ///< number of retained samples
+  uint8_t group_count;        ///< number of exchanges so far in the present group
+  unsigned long group_delay;  ///< shortest round-trip delay in the present group
+  unsigned long group_local;  ///< local time of the fastest exchange in the group
+  long group_offset;          ///< reference less local time of the fastest exchange in the group
+
+  /// Set the clock model to the least-squares fit through the retained samples.
+  void fit(unsigned long local);
+
+public:
+
+  /// Main constructor.  The disciplined clock initially matches the local clock.
+  SyncClock();
+
+  /// Convert a local micros() value to disciplined time in microseconds.  This
+  /// should be called at least once every half hour so the interval since the
+  /// last rebase cannot overflow.
+  unsigned long now(unsigned long local);
+
+  /// Apply a reference sample: at the moment the disciplined clock read
+  /// 'synced', the host reference clock read 'reference'.  The local argument is
+  /// the current micros() value, and delay is the round-trip delay of the
+  /// exchange in microseconds, or zero if unknown.
+  void synchronize(unsigned long local, unsigned long synced, unsigned long reference, unsigned long delay);
+
+  /// Return the most recent measured offset in microseconds.
+  long lastError(void) { return last_error; }
+
+  /// Return the frequency trim in parts per billion.
+  long rateTrimPPB(void) { return (long) (rate_trim * 1e9); }
+
+  /// Return true once the clock has been set from the host.
+  bool isLocked(void) { return locked; }
+};
+
+#endif //__SYNCCLOCK_H_INCLUDED__
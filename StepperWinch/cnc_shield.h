@@ -39,6 +39,19 @@
 #define Y_LIMIT_PIN 10
 #define Z_LIMIT_PIN 11
 
+/// Optional quadrature encoder inputs, using the analog header pins labeled
+/// Abort, Hold, Resume and CoolEn on the CNC Shield.
+#define X_ENCODER_A_PIN A0
+#define X_ENCODER_B_PIN A1
+#define Y_ENCODER_A_PIN A2
+#define Y_ENCODER_B_PIN A3
+
+/// Optional PWM output driving the A4988 VREF inputs through an RC filter, so
+/// that the motors may be held at reduced current while idle.  Every PWM pin
+/// of an Uno is already taken by the CNC Shield, so this is only defined for a
+/// board which has been modified to wire one.
+// #define DRIVER_VREF_PWM_PIN 44
+
 /// Optional spindle control output pins.
 #define SPINDLE_ENABLE_PIN 12
 #define SPINDLE_DIR_PIN 13  // N.B. this usually is also the onboard LED.
@@ -12,8 +12,10 @@
 // exist in the same global namespace as the main .ino file.
 
 // N.B. the function serial_input_poll() directly calls parse_input_message()
-// when a complete input line has been received; this function must be provided
-// elsewhere in the sketch.
+// when a complete input line has been received, and stream_begin(),
+// stream_argument() and stream_end() for motion commands scanned as they
+// arrive; these functions must be provided elsewhere in the sketch.  Numeric tokens are converted as their characters
+// arrive using NumberScanner, so the parser receives them ready to use.
 
 /****************************************************************/
 
@@ -23,79 +25,315 @@
 // The maximum number of tokens in a single message.
 #define MAX_TOKENS 10
 
+// The maximum number of characters processed in one call to serial_input_poll().
+#define MAX_POLL_BYTES 64
+
+// The size of the hardware serial receive buffer, used to report credit.
+#ifndef SERIAL_RX_BUFFER_SIZE
+#define SERIAL_RX_BUFFER_SIZE 64
+#endif
+
+/****************************************************************/
+
+// Sequence number of the message being processed, or -1 if it has none.
+static long message_sequence = -1;
+
+// Flag set if any error was reported while processing the current message.
+static int message_error = 0;
+
 /****************************************************************/
 /**** Utility functions *****************************************/
 /****************************************************************/
 
+// Message keywords and debugging text are passed as program memory strings,
+// e.g. F("awake"), so that they occupy no RAM.
+
 /// Send a single debugging string to the console.
-static void send_debug_message( const char *str )
+static void send_debug_message( const __FlashStringHelper *str )
 {
-  Serial.print("dbg ");
+  Serial.print(F("dbg "));
   Serial.println( str );
 }
 
 
+/****************************************************************/
+/// Report an error in the current message.  For a numbered message the error
+/// is reported by the final nak instead of a debugging message.
+static void send_error_message( const __FlashStringHelper *str )
+{
+  message_error = 1;
+  if (message_sequence < 0) send_debug_message( str );
+}
+
 /****************************************************************/
 /// Send a zero-argument message back to the host.
-static void send_message( const char *command )
+static void send_message( const __FlashStringHelper *command )
 {
   Serial.println( command );
 }
 
+/****************************************************************/
+/// Send a single-argument message back to the host.
+static void send_message( const __FlashStringHelper *command, unsigned long value )
+{
+  Serial.print( command );
+  Serial.print( ' ' );
+  Serial.println( value );
+}
+
+/****************************************************************/
+/// Send a two-argument message back to the host.
+static void send_message( const __FlashStringHelper *command, long value1, long value2 )
+{
+  Serial.print( command );
+  Serial.print( ' ' );
+  Serial.print( value1 );
+  Serial.print( ' ' );
+  Serial.println( value2 );
+}
+
+/****************************************************************/
+/// Send a three-argument message back to the host.
+static void send_message( const __FlashStringHelper *command, long value1, long value2, long value3 )
+{
+  Serial.print( command );
+  Serial.print( ' ' );
+  Serial.print( value1 );
+  Serial.print( ' ' );
+  Serial.print( value2 );
+  Serial.print( ' ' );
+  Serial.println( value3 );
+}
+
+/****************************************************************/
+/// Send a message naming a single axis with one value back to the host.
+static void send_message( const __FlashStringHelper *command, char axis, long value )
+{
+  Serial.print( command );
+  Serial.print( ' ' );
+  Serial.print( axis );
+  Serial.print( ' ' );
+  Serial.println( value );
+}
+
 /****************************************************************/
 /// Send a five-argument message back to the host.
-static void send_message( const char *command, long value1, long value2, long value3, long value4, long value5 )
+static void send_message( const __FlashStringHelper *command, long value1, long value2, long value3, long value4, long value5 )
 {
   Serial.print( command );
-  Serial.print( " " );
+  Serial.print( ' ' );
   Serial.print( value1 );
-  Serial.print( " " );
+  Serial.print( ' ' );
   Serial.print( value2 );
-  Serial.print( " " );
+  Serial.print( ' ' );
   Serial.print( value3 );
-  Serial.print( " " );
+  Serial.print( ' ' );
   Serial.print( value4 );
-  Serial.print( " " );
+  Serial.print( ' ' );
   Serial.println( value5 );
 }
 
 /****************************************************************/
-/// Wrapper on strcmp for clarity of code.  Returns true if strings are
-/// identical.
-static int string_equal( char *str1, const char str2[])
+/// Process a message which is not the line being received, such as a
+/// scheduled command.  It runs between the bytes of some other line, so its
+/// errors are reported as debugging messages and do not mark that line for a
+/// nak.
+static void parse_detached_message( int argc, char *argv[], NumberScanner argn[] )
+{
+  long sequence = message_sequence;
+  int error = message_error;
+  message_sequence = -1;
+  parse_input_message( argc, argv, argn );
+  message_sequence = sequence;
+  message_error = error;
+}
+
+/****************************************************************/
+/// Finish a numbered message by sending an ack or nak with the current
+/// receive buffer credit, then clear the message state.
+static void finish_message( void )
 {
-  return !strcmp(str1, str2);
+  if (message_sequence >= 0) {
+    long credit = max(0, SERIAL_RX_BUFFER_SIZE - 1 - Serial.available());
+    send_message( message_error ? F("nak") : F("ack"), message_sequence, credit );
+  }
+  message_sequence = -1;
+  message_error = 0;
+}
+
+/****************************************************************/
+/**** Line rate negotiation *************************************/
+/****************************************************************/
+
+// Time in microseconds allowed for the host to confirm a new rate.
+#define BAUD_TRIAL_TIMEOUT 1000000UL
+
+// Number of consecutive corrupted lines at a negotiated rate after which the
+// default rate is restored.
+#define BAUD_ERROR_LIMIT 3
+
+static unsigned long baud_default = 0;     // startup rate
+static unsigned long baud_rate = 0;        // rate currently in effect
+static unsigned long baud_previous = 0;    // last confirmed rate, restored if a trial fails
+static unsigned long baud_pending = 0;     // rate to switch to once pending output is sent, or zero
+static unsigned long baud_trial_start = 0; // micros() at which an unconfirmed rate took effect
+static bool baud_trial = false;            // true while a new rate awaits confirmation
+static uint8_t baud_errors = 0;            // consecutive corrupted lines
+
+/// Open the serial port at the startup rate.
+static void serial_baud_begin( unsigned long rate )
+{
+  baud_default = baud_rate = baud_previous = rate;
+  Serial.begin(rate);
+}
+
+/// Return true for the rates which may be negotiated.  The faster rates divide
+/// the 16 MHz clock exactly in double-speed mode.
+static bool serial_baud_valid( unsigned long rate )
+{
+  return rate == baud_default || rate == 250000UL || rate == 500000UL || rate == 1000000UL;
+}
+
+/// Restore the last confirmed rate and announce it once the switch is made.
+static void serial_baud_revert( void )
+{
+  baud_trial = false;
+  baud_errors = 0;
+  baud_pending = baud_previous;
+}
+
+/****************************************************************/
+/// Handle a 'baud <rate>' request.  Outside a trial this proposes a rate: the
+/// reply is sent at the current rate and serial_baud_poll() switches once it
+/// has been transmitted.  During a trial, a request for the trial rate confirms
+/// it.  Returns false if the rate is not supported.
+static bool serial_baud_request( unsigned long rate )
+{
+  if (!serial_baud_valid(rate)) return false;
+
+  if (baud_trial) {
+    // any other request is left for serial_baud_line() to reject
+    if (rate == baud_rate) {
+      baud_trial = false;
+      baud_previous = rate;
+      send_message(F("baud"), rate);
+    }
+  } else {
+    send_message(F("baud"), rate);
+    if (rate != baud_rate) baud_pending = rate;
+  }
+  return true;
+}
+
+/****************************************************************/
+/// Account for a completed non-empty input line.  During a trial any line
+/// other than the confirmation ends it; otherwise repeated corrupted lines at
+/// a negotiated rate fall back to the default rate.
+static void serial_baud_line( int corrupt )
+{
+  if (baud_trial) serial_baud_revert();
+  else if (!corrupt) baud_errors = 0;
+  else if (baud_rate != baud_default && ++baud_errors >= BAUD_ERROR_LIMIT) {
+    baud_previous = baud_default;
+    serial_baud_revert();
+  }
+}
+
+/****************************************************************/
+/// Polling function to carry out rate changes and expire unconfirmed trials.
+/// The switch waits for the transmit buffer to drain, which blocks the event
+/// loop for at most a few milliseconds; the step interrupt keeps running.
+static void serial_baud_poll( void )
+{
+  if (baud_pending) {
+    Serial.flush();
+    Serial.end();
+    Serial.begin(baud_pending);
+    baud_rate = baud_pending;
+    baud_pending = 0;
+
+    // a fallback is announced at the restored rate; a proposal starts a trial
+    if (baud_rate == baud_previous) send_message(F("baud"), baud_rate);
+    else {
+      baud_trial = true;
+      baud_trial_start = micros();
+    }
+  }
+  else if (baud_trial && (micros() - baud_trial_start) > BAUD_TRIAL_TIMEOUT) serial_baud_revert();
+}
+
+/****************************************************************/
+/// Wrapper on strcmp_P for clarity of code.  The second string is in program
+/// memory, e.g. PSTR("ping").  Returns true if strings are identical.
+static int string_equal( char *str1, PGM_P str2 )
+{
+  return !strcmp_P(str1, str2);
 }
 
 /****************************************************************/
 /// Polling function to process messages arriving over the serial port.  Each
-/// iteration through this polling function processes at most one character.  It
+/// iteration through this polling function processes the characters already
+/// received, up to MAX_POLL_BYTES.  It
 /// records the input message line into a buffer while simultaneously dividing it
 /// into 'tokens' delimited by whitespace.  Each token is a string of
-/// non-whitespace characters, and might represent either a symbol or an integer.
-/// Once a message is complete, parse_input_message() is called.
+/// non-whitespace characters, and might represent either a symbol or a number;
+/// each character is also fed to a NumberScanner for its token, so numeric
+/// values are available the moment the line ends.  Once a message is complete,
+/// parse_input_message() is called.
+///
+/// Per-axis motion commands are handled as a stream instead: once the command
+/// and flag tokens are complete and stream_begin() accepts them, each
+/// following argument is scanned without being buffered and passed to
+/// stream_argument() as soon as its token ends, and stream_end() applies the
+/// whole line once it is complete.  These lines are not limited by the buffer
+/// size or token count.
 
 void serial_input_poll(void)
 {
   static char input_buffer[ MAX_LINE_LENGTH ];   // buffer for input characters
   static char *argv[MAX_TOKENS];                 // buffer for pointers to tokens
+  static NumberScanner argn[MAX_TOKENS];         // numeric value of each token
+  static NumberScanner stream_number;            // numeric value of the open token while streaming
   static int chars_in_buffer = 0;  // counter for characters in buffer
   static int chars_in_token = 0;   // counter for characters in current partially-received token (the 'open' token)
-  static int argc = 0;             // counter for tokens in argv
-  static int error = 0;            // flag for any error condition in the current message
+  static int argc = 0;             // counter for tokens in argv, or total tokens while streaming
+  static int streaming = 0;        // flag set once a motion command is applying arguments on arrival
+  static int error = 0;            // error in the current message: 1 for excessive input, 2 if already reported
 
-  // Check if at least one byte is available on the serial input.
-  if (Serial.available()) {
+  // Process the bytes available on the serial input, up to a limit so that a
+  // continuous stream cannot hold off the path generators.
+  for (int polled = 0; polled < MAX_POLL_BYTES && Serial.available(); polled++) {
     int input = Serial.read();
 
     // If the input is a whitespace character, end any currently open token.
     if ( isspace(input) ) {
       if ( !error && chars_in_token > 0) {
-	if (chars_in_buffer == MAX_LINE_LENGTH) error = 1;
+	if (streaming) {
+	  // check and keep the completed argument
+	  if (!stream_argument(argc - 2, &stream_number)) error = 2;
+	  argc++;
+	  chars_in_token = 0;
+	}
+	else if (chars_in_buffer == MAX_LINE_LENGTH) error = 1;
 	else {
 	  input_buffer[chars_in_buffer++] = 0;  // end the current token
 	  argc++;                               // increase the argument count
 	  chars_in_token = 0;                   // reset the token state
+
+	  // a leading @<number> token is a sequence number rather than part of the message
+	  if (argc == 1 && argv[0][0] == '@' && message_sequence < 0) {
+	    unsigned long sequence;
+	    argn[0].scan(argv[0] + 1);
+	    if (argn[0].toULong(&sequence) && sequence <= 0x7fffffffUL) message_sequence = sequence;
+	    else {
+	      send_error_message(F("invalid sequence number"));
+	      error = 2;
+	    }
+	    chars_in_buffer = argc = 0;
+	  }
+
+	  // once the command and flags are known, a motion command may switch to streaming
+	  if (argc == 2) streaming = stream_begin(argv[0], argv[1]);
 	}
       }
 
@@ -103,13 +341,40 @@ void serial_input_poll(void)
       if (input == '\r' || input == '\n') {
 
 	// if the message included too many tokens or too many characters, report an error
-	if (error) send_debug_message("excessive input error");
+	if (error == 1) send_error_message(F("excessive input error"));
+
+	// else finish a streamed message, checking the argument count
+	else if (streaming) { if (!error) stream_end(argc - 2); }
 
 	// else process any complete message
-	else if (argc > 0) parse_input_message( argc, argv );
+	else if (!error && argc > 0) parse_input_message( argc, argv, argn );
+
+	// a numbered line with no command is an error
+	else if (!error && message_sequence >= 0) send_error_message(F("empty message"));
+
+	// acknowledge a numbered message
+	finish_message();
+
+	// a confirmed, rejected or corrupted line may affect a rate trial
+	if (error || argc > 0) serial_baud_line(error == 1);
 
 	// reset the full input state
-	error = chars_in_token = chars_in_buffer = argc = 0;
+	error = chars_in_token = chars_in_buffer = argc = streaming = 0;
+      }
+    }
+
+    // Control and non-ASCII characters can only come from line noise; they
+    // invalidate the current message rather than being stored in a token.
+    else if (input < 0x21 || input > 0x7e) {
+      if (!error) error = 1;
+    }
+
+    // Else while streaming, the input is scanned but not stored.
+    else if (streaming) {
+      if (!error) {
+	if (chars_in_token == 0) stream_number.reset();
+	stream_number.scan((char) input);
+	chars_in_token = 1;
       }
     }
 
@@ -122,14 +387,18 @@ void serial_input_poll(void)
 	if (argc == MAX_TOKENS) error = 1;
 
 	// otherwise save a pointer to the start of the token
-	else argv[ argc ] = &input_buffer[chars_in_buffer];
+	else {
+	  argv[ argc ] = &input_buffer[chars_in_buffer];
+	  argn[ argc ].reset();
+	}
       }
 
-      // the save the input and update the counters
+      // the save the input, scan it, and update the counters
       if (!error) {
 	if (chars_in_buffer == MAX_LINE_LENGTH) error = 1;
 	else {
 	  input_buffer[chars_in_buffer++] = input;
+	  argn[ argc ].scan((char) input);
 	  chars_in_token++;
 	}
       }
@@ -0,0 +1,586 @@
+/// \file WinchClient.cpp
+/// \brief Host-side client library for one or more StepperWinch boards.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "WinchClient.h"
+
+// Default flow control model.  The firmware drains its receive buffer on each
+// event loop iteration, so it keeps up with the serial line except while a
+// slow command such as an EEPROM write is running; the default rate is half
+// the character rate of the line, and follows it when the rate is changed.
+// The window is slightly smaller than the AVR 64-byte receive buffer.
+#define DEFAULT_DRAIN_FRACTION 0.5
+#define DEFAULT_WINDOW 60.0
+
+// Time in seconds allowed for each step of a line rate negotiation; the
+// firmware abandons an unconfirmed rate after one second.
+#define BAUD_TIMEOUT 1.5
+
+// Number of consecutive corrupted lines at a negotiated rate after which the
+// client assumes the firmware has fallen back to the default rate.
+#define BAUD_ERROR_LIMIT 3
+
+#if defined(TCGETS2) && !defined(BOTHER)
+#define BOTHER 0010000
+#endif
+
+#ifdef TCGETS2
+// The kernel interface for arbitrary rates, which the C library does not declare.
+struct termios2 {
+  tcflag_t c_iflag, c_oflag, c_cflag, c_lflag;
+  cc_t c_line;
+  cc_t c_cc[19];
+  speed_t c_ispeed, c_ospeed;
+};
+#endif
+
+//================================================================
+/// Return a monotonic time in seconds.
+static double monotonic_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+//================================================================
+/// Scan a signed decimal integer starting at *ptr, not reading past end.
+/// Leading spaces are skipped.  Returns false if no digits were found.
+static bool scan_long(const char **ptr, const char *end, long *value)
+{
+  const char *p = *ptr;
+  while (p < end && *p == ' ') p++;
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+  const char *digits = p;
+  unsigned long accum = 0;
+  while (p < end && *p >= '0' && *p <= '9') accum = 10 * accum + (*p++ - '0');
+  if (p == digits) return false;
+
+  *value = negative ? -(long) accum : (long) accum;
+  *ptr = p;
+  return true;
+}
+
+//================================================================
+bool winch_parse_status(const char *begin, const char *end, WinchStatus *status)
+{
+  static const char prefix[] = "txyza ";
+  const size_t prefix_length = sizeof(prefix) - 1;
+
+  if ((size_t) (end - begin) < prefix_length || memcmp(begin, prefix, prefix_length)) return false;
+
+  const char *p = begin + prefix_length;
+  long usec;
+  if (!scan_long(&p, end, &usec)) return false;
+  status->usec = (unsigned long) usec;
+
+  for (int i = 0; i < WINCH_CHANNELS; i++) {
+    if (!scan_long(&p, end, &status->position[i])) return false;
+  }
+  return true;
+}
+
+//================================================================
+/// Map a numeric baud rate to a termios speed constant, or B0 if unsupported.
+static speed_t baud_constant(long baud)
+{
+  switch (baud) {
+  case 9600:    return B9600;
+  case 19200:   return B19200;
+  case 38400:   return B38400;
+  case 57600:   return B57600;
+  case 115200:  return B115200;
+  case 230400:  return B230400;
+  case 500000:  return B500000;
+  case 1000000: return B1000000;
+  default:      return B0;
+  }
+}
+
+//================================================================
+/// Set the line rate of an open device once pending output has been sent.
+/// Rates without a termios constant, such as 250000, use the Linux arbitrary
+/// rate interface.  Returns false if the rate cannot be set.
+static bool set_baud(int fd, long baud)
+{
+  speed_t speed = baud_constant(baud);
+  if (speed != B0) {
+    struct termios tio;
+    if (tcgetattr(fd, &tio)) return false;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    return tcsetattr(fd, TCSADRAIN, &tio) == 0;
+  }
+#ifdef TCGETS2
+  struct termios2 tio2;
+  tcdrain(fd);
+  if (ioctl(fd, TCGETS2, &tio2)) return false;
+  tio2.c_cflag = (tio2.c_cflag & ~CBAUD) | BOTHER;
+  tio2.c_ispeed = tio2.c_ospeed = baud;
+  return ioctl(fd, TCSETS2, &tio2) == 0;
+#else
+  return false;
+#endif
+}
+
+//================================================================
+WinchBoard::WinchBoard(int _index, int _fd, const std::string &_device)
+  : index(_index), fd(_fd), device(_device)
+{
+  next_sequence = 0;
+  acknowledged  = false;
+  in_flight     = 0;
+  output_offset = 0;
+  write_blocked = false;
+  input_length  = 0;
+  corrupt_lines = 0;
+  default_baud  = baud = baud_request = 0;
+  baud_state    = BAUD_IDLE;
+  baud_deadline = 0.0;
+  drain_rate    = 0.0;
+  connected     = true;
+  credit_limit  = DEFAULT_WINDOW;
+  credit        = credit_limit;
+  last_credit_time = monotonic_time();
+}
+
+//================================================================
+WinchClient::WinchClient(int count) : ack_timeout(0.5), running(false)
+{
+  if (count < 1) count = 1;
+  for (int i = 0; i < count; i++) {
+    Worker *worker = new Worker;
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    worker->wake_fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;   // NULL identifies the wakeup descriptor
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd, &event);
+
+    workers.push_back(std::unique_ptr<Worker>(worker));
+  }
+}
+
+//================================================================
+WinchClient::~WinchClient()
+{
+  stop();
+  for (auto &worker : workers) {
+    close(worker->epoll_fd);
+    close(worker->wake_fd);
+  }
+  for (auto &board : boards) close(board->fd);
+}
+
+//================================================================
+int WinchClient::addBoard(const char *device, long baud)
+{
+  int fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) return -1;
+
+  // Configure raw 8N1 operation.  A pty accepts these settings as well.
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~CRTSCTS;
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  if (!set_baud(fd, baud)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  int index = boards.size();
+  WinchBoard *board = new WinchBoard(index, fd, device);
+  board->default_baud = board->baud = baud;
+  board->drain_rate = DEFAULT_DRAIN_FRACTION * baud / 10.0;  // ten bits per character
+  boards.push_back(std::unique_ptr<WinchBoard>(board));
+
+  Worker *worker = workers[index % workers.size()].get();
+  worker->boards.push_back(board);
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.ptr = board;
+  epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+  return index;
+}
+
+//================================================================
+void WinchClient::setFlowControl(int board, double drain_rate, double window)
+{
+  WinchBoard *b = boards.at(board).get();
+  b->drain_rate   = drain_rate;
+  b->credit_limit = window;
+  b->credit       = window;
+}
+
+//================================================================
+void WinchClient::setAcknowledged(int board, bool enable, double window)
+{
+  WinchBoard *b = boards.at(board).get();
+  b->acknowledged = enable;
+  b->credit_limit = window;
+  b->credit       = window;
+}
+
+//================================================================
+void WinchClient::start(void)
+{
+  if (running) return;
+  running = true;
+  for (auto &worker : workers) {
+    Worker *w = worker.get();
+    w->thread = std::thread([this, w]() { run(w); });
+  }
+}
+
+//================================================================
+void WinchClient::stop(void)
+{
+  if (!running) return;
+  running = false;
+  for (auto &worker : workers) {
+    uint64_t one = 1;
+    if (write(worker->wake_fd, &one, sizeof(one)) < 0) { /* worker is already awake */ }
+    worker->thread.join();
+  }
+}
+
+//================================================================
+long WinchClient::send(int board, const std::string &line)
+{
+  WinchBoard *b = boards.at(board).get();
+  long sequence = -1;
+  {
+    std::lock_guard<std::mutex> guard(b->queue_lock);
+    if (b->acknowledged) {
+      sequence = b->next_sequence;
+      b->next_sequence = (b->next_sequence + 1) & 0x7fffffffL;
+      b->pending.push_back(std::make_pair(sequence, "@" + std::to_string(sequence) + " " + line + "\n"));
+    } else b->pending.push_back(std::make_pair(sequence, line + "\n"));
+  }
+  uint64_t one = 1;
+  Worker *worker = workers[board % workers.size()].get();
+  if (write(worker->wake_fd, &one, sizeof(one)) < 0) { /* counter saturated, worker will wake anyway */ }
+  return sequence;
+}
+
+//================================================================
+void WinchClient::setBaud(int board, long rate)
+{
+  WinchBoard *b = boards.at(board).get();
+  {
+    std::lock_guard<std::mutex> guard(b->queue_lock);
+    b->pending.push_back(std::make_pair(-rate, "baud " + std::to_string(rate) + "\n"));
+  }
+  uint64_t one = 1;
+  Worker *worker = workers[board % workers.size()].get();
+  if (write(worker->wake_fd, &one, sizeof(one)) < 0) { /* counter saturated, worker will wake anyway */ }
+}
+
+//================================================================
+size_t WinchClient::backlog(int board)
+{
+  WinchBoard *b = boards.at(board).get();
+  std::lock_guard<std::mutex> guard(b->queue_lock);
+  size_t total = 0;
+  for (auto &line : b->pending) total += line.second.size();
+  return total;
+}
+
+//================================================================
+// Process an 'ack <sequence> <credit>' or 'nak <sequence> <credit>' reply.
+// Returns false if the line is not a reply.
+bool WinchClient::handle_ack(WinchBoard *board, const char *begin, const char *end)
+{
+  if (end - begin < 4 || (memcmp(begin, "ack ", 4) && memcmp(begin, "nak ", 4))) return false;
+
+  bool applied = (begin[0] == 'a');
+  const char *p = begin + 4;
+  long sequence;
+  if (!scan_long(&p, end, &sequence)) return false;
+
+  // Replies arrive in order, so any earlier outstanding line lost its reply.
+  while (!board->outstanding.empty()) {
+    WinchBoard::Outstanding entry = board->outstanding.front();
+    long age = (sequence - entry.sequence) & 0x7fffffffL;
+    if (age > 0x3fffffffL) break;   // entry is newer than this reply
+    board->outstanding.pop_front();
+    board->in_flight -= entry.bytes;
+    if (ack_handler) ack_handler(board->index, entry.sequence, (entry.sequence == sequence) && applied);
+    if (entry.sequence == sequence) break;
+  }
+  return true;
+}
+
+//================================================================
+// Process a 'baud <rate>' reply during a negotiation.  The reply to a
+// proposal arrives at the old rate, after which both sides switch and the
+// proposal is repeated as confirmation; the reply to that completes the
+// change.  Returns false if the line is not a reply.
+bool WinchClient::handle_baud(WinchBoard *board, const char *begin, const char *end, double now)
+{
+  if (end - begin < 5 || memcmp(begin, "baud ", 5)) return false;
+
+  const char *p = begin + 5;
+  long rate;
+  if (!scan_long(&p, end, &rate)) return false;
+  if (board->baud_state == WinchBoard::BAUD_IDLE || rate != board->baud_request) return true;
+
+  if (board->baud_state == WinchBoard::BAUD_PROPOSED) {
+    if (!set_baud(board->fd, rate)) { fall_back(board, board->baud); return true; }
+    board->output += "baud " + std::to_string(rate) + "\n";
+    board->baud_state = WinchBoard::BAUD_TRIAL;
+    board->baud_deadline = now + BAUD_TIMEOUT;
+
+  } else {
+    change_rate(board, rate);
+    board->baud_state = WinchBoard::BAUD_IDLE;
+    board->corrupt_lines = 0;
+    if (baud_handler) baud_handler(board->index, rate, true);
+  }
+  return true;
+}
+
+//================================================================
+// Record a new line rate, scaling the flow control drain rate with it.
+void WinchClient::change_rate(WinchBoard *board, long rate)
+{
+  board->drain_rate *= (double) rate / board->baud;
+  board->baud = rate;
+}
+
+//================================================================
+// Return to the given rate after a failed negotiation or repeated line errors.
+void WinchClient::fall_back(WinchBoard *board, long rate)
+{
+  set_baud(board->fd, rate);
+  change_rate(board, rate);
+  board->baud_state = WinchBoard::BAUD_IDLE;
+  board->corrupt_lines = 0;
+  if (baud_handler) baud_handler(board->index, rate, false);
+}
+
+//================================================================
+// Report lines whose replies have not arrived within the timeout as lost.
+void WinchClient::expire_acks(WinchBoard *board, double now)
+{
+  while (!board->outstanding.empty() && now - board->outstanding.front().time > ack_timeout) {
+    WinchBoard::Outstanding entry = board->outstanding.front();
+    board->outstanding.pop_front();
+    board->in_flight -= entry.bytes;
+    if (ack_handler) ack_handler(board->index, entry.sequence, false);
+  }
+}
+
+//================================================================
+// Read all available input, dispatching each complete line.  Returns false at
+// end of file or on a device error.
+bool WinchClient::service_input(WinchBoard *board)
+{
+  for (;;) {
+    size_t space = sizeof(board->input) - board->input_length;
+    if (space == 0) {
+      // A line longer than the buffer cannot be valid protocol; discard it.
+      board->input_length = 0;
+      space = sizeof(board->input);
+    }
+
+    ssize_t count = read(board->fd, board->input + board->input_length, space);
+    if (count == 0) return false;
+    if (count < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    board->input_length += count;
+
+    // Dispatch each complete line directly from the receive buffer.
+    char *start = board->input;
+    char *end = board->input + board->input_length;
+    char *newline;
+    while ((newline = (char *) memchr(start, '\n', end - start)) != NULL) {
+      char *line_end = newline;
+      if (line_end > start && line_end[-1] == '\r') line_end--;
+
+      // Characters outside printable ASCII indicate a line rate mismatch.
+      bool corrupt = false;
+      for (char *c = start; c < line_end; c++) if (*c < 0x20 || *c > 0x7e) corrupt = true;
+      if (!corrupt) board->corrupt_lines = 0;
+      else if (board->baud_state == WinchBoard::BAUD_IDLE && board->baud != board->default_baud
+	       && ++board->corrupt_lines >= BAUD_ERROR_LIMIT) fall_back(board, board->default_baud);
+
+      if (line_end > start && !corrupt) {
+	WinchStatus status;
+	if (winch_parse_status(start, line_end, &status)) {
+	  if (status_handler) status_handler(board->index, status);
+	} else if (board->acknowledged && handle_ack(board, start, line_end)) {
+	  // reply consumed
+	} else if (handle_baud(board, start, line_end, monotonic_time())) {
+	  // reply consumed
+	} else if (line_handler) line_handler(board->index, start, line_end - start);
+      }
+      start = newline + 1;
+    }
+
+    // Retain any partial line at the start of the buffer.
+    board->input_length = end - start;
+    if (board->input_length > 0 && start != board->input) memmove(board->input, start, board->input_length);
+  }
+}
+
+//================================================================
+// Write as much queued output as the flow control credit allows.
+void WinchClient::service_output(Worker *worker, WinchBoard *board, double now)
+{
+  // An unanswered negotiation returns to the last confirmed rate.
+  if (board->baud_state != WinchBoard::BAUD_IDLE && now > board->baud_deadline) fall_back(board, board->baud);
+
+  if (board->acknowledged) {
+    // The credit is whatever the outstanding lines leave of the window.
+    expire_acks(board, now);
+    board->credit = board->credit_limit - board->in_flight;
+  } else {
+    // Replenish the credit at the estimated drain rate.
+    board->credit = std::min(board->credit_limit, board->credit + (now - board->last_credit_time) * board->drain_rate);
+    board->last_credit_time = now;
+  }
+
+  // Transfer newly queued lines to the worker-owned output buffer.  In
+  // acknowledged mode whole lines are released only when they fit the window.
+  {
+    std::lock_guard<std::mutex> guard(board->queue_lock);
+    if (board->output_offset == board->output.size()) {
+      board->output.clear();
+      board->output_offset = 0;
+    }
+    while (!board->pending.empty() && board->baud_state == WinchBoard::BAUD_IDLE) {
+      std::pair<long, std::string> &line = board->pending.front();
+      if (line.first < -1) {
+	// A rate proposal holds all later output until it has been resolved.
+	board->baud_request = -line.first;
+	board->baud_state = WinchBoard::BAUD_PROPOSED;
+	board->baud_deadline = now + BAUD_TIMEOUT;
+      } else if (board->acknowledged) {
+	if (!board->outstanding.empty() && board->in_flight + line.second.size() > board->credit_limit) break;
+	WinchBoard::Outstanding entry = { line.first, line.second.size(), now };
+	board->outstanding.push_back(entry);
+	board->in_flight += entry.bytes;
+      }
+      board->output += line.second;
+      board->pending.pop_front();
+    }
+    if (board->acknowledged) board->credit = board->output.size() - board->output_offset;
+  }
+
+  bool blocked = false;
+  while (board->output_offset < board->output.size()) {
+    size_t allowed = std::min((size_t) board->credit, board->output.size() - board->output_offset);
+    if (allowed == 0) break;
+
+    ssize_t count = write(board->fd, board->output.data() + board->output_offset, allowed);
+    if (count < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) blocked = true;
+      break;
+    }
+    board->output_offset += count;
+    board->credit -= count;
+  }
+
+  // Only request writability notification while the device itself is full.
+  if (blocked != board->write_blocked) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = blocked ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    event.data.ptr = board;
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, board->fd, &event);
+    board->write_blocked = blocked;
+  }
+}
+
+//================================================================
+// Stop servicing a board whose device has hung up or failed.
+void WinchClient::disconnect(Worker *worker, WinchBoard *board)
+{
+  epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, board->fd, NULL);
+  board->connected = false;
+
+  while (!board->outstanding.empty()) {
+    WinchBoard::Outstanding entry = board->outstanding.front();
+    board->outstanding.pop_front();
+    if (ack_handler) ack_handler(board->index, entry.sequence, false);
+  }
+  board->in_flight = 0;
+  if (disconnect_handler) disconnect_handler(board->index);
+}
+
+//================================================================
+// Worker thread event loop.
+void WinchClient::run(Worker *worker)
+{
+  struct epoll_event events[16];
+  int timeout = 0;
+
+  while (running) {
+    int count = epoll_wait(worker->epoll_fd, events, 16, timeout);
+    if (count < 0 && errno != EINTR) break;
+
+    for (int i = 0; i < count; i++) {
+      WinchBoard *board = (WinchBoard *) events[i].data.ptr;
+      if (board == NULL) {
+	uint64_t value;
+	if (read(worker->wake_fd, &value, sizeof(value)) < 0) { /* already cleared */ }
+      } else if (board->connected && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+	// A hangup is reported on every wait until the descriptor is removed,
+	// so any remaining input is read first and the board is then dropped.
+	if (!service_input(board) || (events[i].events & (EPOLLHUP | EPOLLERR))) disconnect(worker, board);
+      }
+    }
+
+    // Service output on every pass, and sleep only until the earliest board
+    // regains enough credit to write again.
+    double now = monotonic_time();
+    double wait = -1.0;
+    for (WinchBoard *board : worker->boards) {
+      if (!board->connected) continue;
+      service_output(worker, board, now);
+      double needed = -1.0;
+      if (board->acknowledged) {
+	if (!board->outstanding.empty()) needed = board->outstanding.front().time + ack_timeout - now;
+      } else if (board->output_offset < board->output.size() && board->credit < 1.0) {
+	needed = (1.0 - board->credit) / board->drain_rate;
+      }
+      if (board->baud_state != WinchBoard::BAUD_IDLE) {
+	double remaining = std::max(0.0, board->baud_deadline - now);
+	if (needed < 0.0 || remaining < needed) needed = remaining;
+      }
+      if (needed >= 0.0 && (wait < 0.0 || needed < wait)) wait = needed;
+    }
+    timeout = (wait < 0.0) ? -1 : std::max(1, (int) (1000.0 * wait + 0.5));
+  }
+}
+//================================================================
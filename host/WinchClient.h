@@ -0,0 +1,229 @@
+/// \file WinchClient.h
+/// \brief Host-side client library for one or more StepperWinch boards.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details This library speaks the line-oriented ASCII protocol implemented by
+/// parse_input_message() in StepperWinch.ino.  Each board is attached to a
+/// serial device (a tty, or a pty for testing) which is operated in
+/// non-blocking mode.  Boards are distributed over a small number of worker
+/// threads, each running an epoll loop, so that a single process can drive
+/// dozens of boards at the full status rate.
+///
+/// Commands are pipelined: the caller queues lines without waiting, and the
+/// worker writes them as soon as flow control allows.  The firmware has a
+/// 64-byte receive buffer which it drains between other work, so the client
+/// limits the number of bytes in flight.  By default the credit is
+/// replenished at the expected drain rate, which follows the line rate.  In acknowledged mode each line is
+/// prefixed with an @<sequence> token, and the bytes of a line remain in
+/// flight until the firmware's ack or nak for it arrives, so the link can be
+/// kept full without overrunning the board or losing commands unnoticed.
+///
+/// Incoming 'txyza' status lines are parsed in place from the receive buffer
+/// into a WinchStatus record; all other lines are passed through verbatim.
+/// A board whose device hangs up or fails is removed from its worker's epoll
+/// set and reported to the disconnect callback.
+///
+/// Linux only.  Build with e.g.:
+///   g++ -std=c++11 -O2 -pthread -c WinchClient.cpp
+
+#ifndef __WINCHCLIENT_H_INCLUDED__
+#define __WINCHCLIENT_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Number of stepper channels reported by each board.
+#define WINCH_CHANNELS 4
+
+/// Decoded 'txyza' status report.
+struct WinchStatus {
+  unsigned long usec;              ///< board clock time in microseconds
+  long position[WINCH_CHANNELS];   ///< absolute step positions, in xyza order
+};
+
+/// Parse a status line of the form 'txyza <usec> <x> <y> <z> <a>' held in the
+/// character range [begin, end).  The text is not copied or modified.  Returns
+/// true if the line was a well-formed status report.
+bool winch_parse_status(const char *begin, const char *end, WinchStatus *status);
+
+// ================================================================
+/// State for a single board attached to a serial device.  Instances are
+/// created and owned by WinchClient.
+class WinchBoard {
+  friend class WinchClient;
+
+private:
+  int index;                       ///< board number assigned by WinchClient
+  int fd;                          ///< non-blocking serial device descriptor
+  std::string device;              ///< device path, for diagnostics
+  std::atomic<bool> connected;     ///< false once the device has hung up or failed
+
+  std::mutex queue_lock;           ///< protects pending and next_sequence, which callers modify
+  std::deque<std::pair<long, std::string>> pending; ///< queued sequence numbers (or negated baud rates for rate proposals) and lines not yet passed to the worker
+  long next_sequence;              ///< sequence number for the next line in acknowledged mode
+
+  /// A numbered line awaiting acknowledgement.
+  struct Outstanding {
+    long sequence;                 ///< sequence number sent with the line
+    size_t bytes;                  ///< length of the line including the prefix
+    double time;                   ///< monotonic time at which it was queued for output
+  };
+  bool acknowledged;               ///< true if lines are numbered and acknowledged
+  std::deque<Outstanding> outstanding; ///< numbered lines written but not yet acknowledged
+  size_t in_flight;                ///< total bytes of the outstanding lines
+
+  std::string output;              ///< bytes owned by the worker awaiting write()
+  size_t output_offset;            ///< bytes of output already written
+  bool write_blocked;              ///< true while waiting for EPOLLOUT on the device
+
+  char input[512];                 ///< receive buffer holding at most one partial line
+  size_t input_length;             ///< bytes currently held in input
+  int corrupt_lines;               ///< consecutive received lines with invalid characters
+
+  /// Progress of a line rate negotiation.
+  enum BaudState { BAUD_IDLE, BAUD_PROPOSED, BAUD_TRIAL };
+  long default_baud;               ///< rate given to addBoard(), which the firmware falls back to
+  long baud;                       ///< rate currently in effect
+  long baud_request;               ///< rate being negotiated
+  BaudState baud_state;            ///< negotiation state; output is held unless idle
+  double baud_deadline;            ///< monotonic time at which the negotiation is abandoned
+
+  double credit;                   ///< bytes which may be written without overrunning the board
+  double drain_rate;               ///< estimated rate at which the board consumes input at the current line rate, bytes/sec
+  double credit_limit;             ///< maximum credit, i.e. the board receive buffer size
+  double last_credit_time;         ///< monotonic time of the last credit update, in seconds
+
+  WinchBoard(int index, int fd, const std::string &device);
+};
+
+// ================================================================
+/// Client managing a set of boards on a pool of worker threads.
+class WinchClient {
+
+public:
+  /// Callback for decoded status reports; the arguments are the board number and the report.
+  typedef std::function<void(int, const WinchStatus &)> StatusHandler;
+
+  /// Callback for all other received lines; the arguments are the board
+  /// number, and the start and length of the line text without terminator.
+  typedef std::function<void(int, const char *, size_t)> LineHandler;
+
+  /// Callback for acknowledgements in acknowledged mode; the arguments are the
+  /// board number, the sequence number returned by send(), and true if the
+  /// line was applied.  A line whose reply was lost or timed out is reported
+  /// as not applied.
+  typedef std::function<void(int, long, bool)> AckHandler;
+
+  /// Callback for line rate changes; the arguments are the board number, the
+  /// rate now in effect, and true if it is a newly confirmed rate rather than
+  /// a fallback after a failed negotiation or repeated line errors.
+  typedef std::function<void(int, long, bool)> BaudHandler;
+
+  /// Callback for a board whose device has hung up or failed; the argument is
+  /// the board number.  The board is no longer serviced and its outstanding
+  /// lines have been reported as not applied.
+  typedef std::function<void(int)> DisconnectHandler;
+
+  /// Main constructor.  The argument is the number of worker threads; boards
+  /// are assigned to workers round-robin.
+  WinchClient(int workers = 1);
+
+  /// Destructor; stops the workers and closes all devices.
+  ~WinchClient();
+
+  /// Open a serial device and configure it for raw non-blocking I/O at the
+  /// given baud rate.  Returns the board number, or -1 on error (with errno set).
+  /// Boards must all be added before start().
+  int addBoard(const char *device, long baud = 115200);
+
+  /// Set the callbacks.  These are invoked from worker threads, possibly
+  /// concurrently for different boards, and must not block.
+  void onStatus(StatusHandler handler) { status_handler = handler; }
+  void onLine(LineHandler handler)     { line_handler = handler; }
+  void onAck(AckHandler handler)       { ack_handler = handler; }
+  void onBaud(BaudHandler handler)     { baud_handler = handler; }
+  void onDisconnect(DisconnectHandler handler) { disconnect_handler = handler; }
+
+  /// Start the worker threads.
+  void start(void);
+
+  /// Stop and join the worker threads.  Queued output not yet written is discarded.
+  void stop(void);
+
+  /// Queue a command line for a board.  The newline is appended by the library.
+  /// This does not block and may be called from any thread.  Returns the
+  /// sequence number in acknowledged mode, else -1.
+  long send(int board, const std::string &line);
+
+  /// Return the number of queued bytes not yet written to the given board.
+  size_t backlog(int board);
+
+  /// Return false once the device of the given board has hung up or failed.
+  bool isConnected(int board) { return boards.at(board)->connected; }
+
+  /// Configure the flow control model for a board: the rate in bytes/sec at
+  /// which the firmware consumes input at the rate given to addBoard(), and
+  /// the number of bytes which may be outstanding.  The drain rate is scaled
+  /// with the line rate after a negotiation.  Must be called before start().
+  void setFlowControl(int board, double drain_rate, double window);
+
+  /// Select acknowledged mode for a board, in which each line is numbered and
+  /// flow control is driven by the firmware replies rather than a rate model.
+  /// The window is the receive buffer credit.  Must be called before start().
+  void setAcknowledged(int board, bool enable, double window = 63);
+
+  /// Queue a line rate negotiation for a board.  Lines queued earlier are sent
+  /// first at the current rate; later lines are held until the firmware has
+  /// confirmed the new rate or both sides have fallen back to the old one.
+  /// The outcome is reported to onBaud().  The firmware accepts 250000,
+  /// 500000 and 1000000 in addition to its startup rate.
+  void setBaud(int board, long rate);
+
+  /// Time in seconds after which an unacknowledged line is reported as lost.
+  void setAckTimeout(double seconds) { ack_timeout = seconds; }
+
+private:
+  struct Worker {
+    int epoll_fd;                  ///< epoll instance watching this worker's boards
+    int wake_fd;                   ///< eventfd used to signal newly queued output
+    std::vector<WinchBoard *> boards;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<WinchBoard>> boards;
+  std::vector<std::unique_ptr<Worker>> workers;
+  StatusHandler status_handler;
+  LineHandler line_handler;
+  AckHandler ack_handler;
+  BaudHandler baud_handler;
+  DisconnectHandler disconnect_handler;
+  double ack_timeout;
+  std::atomic<bool> running;
+
+  void run(Worker *worker);
+  bool service_input(WinchBoard *board);
+  void disconnect(Worker *worker, WinchBoard *board);
+  bool handle_ack(WinchBoard *board, const char *begin, const char *end);
+  void expire_acks(WinchBoard *board, double now);
+  bool handle_baud(WinchBoard *board, const char *begin, const char *end, double now);
+  void change_rate(WinchBoard *board, long rate);
+  void fall_back(WinchBoard *board, long rate);
+  void service_output(Worker *worker, WinchBoard *board, double now);
+};
+
+#endif //__WINCHCLIENT_H_INCLUDED__
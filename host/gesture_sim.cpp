@@ -0,0 +1,341 @@
+/// \file gesture_sim.cpp
+/// \brief Offline batch evaluator for gesture scripts using the firmware sketch.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details Each gesture script is a text file of protocol commands, one per
+/// line, delivered to the complete sketch compiled natively against the
+/// Arduino shim in native/.  Every command is interpreted by the firmware's
+/// own parse_input_message(), so the full protocol is available, including
+/// waypoints, soft limits, oscillation, splines, stored gestures and
+/// settling.  'wait <milliseconds>' advances time, and '#' starts a comment.
+/// A line the firmware rejects is reported on stderr with its line number.
+/// After the last command the simulation runs until every channel has
+/// settled or the time limit expires.
+///
+/// The sketch keeps its state in globals, so each script runs in its own
+/// forked process in virtual time: the timer interrupt handler is called once
+/// per period and loop() once per tick.  Scripts are evaluated in parallel,
+/// and one line of results is printed per script, in the order given:
+///
+///   <file> <duration-sec> <peak-velocity> <peak-acceleration> <saturated-sec> <overshoot> <oscillation> [timeout]
+///
+/// The peaks, overshoot and oscillation are the largest over all axes, in
+/// steps, steps/sec and steps/sec/sec.  Saturated time is the total time during
+/// which any axis was held at its velocity or acceleration limit.  Overshoot is
+/// the peak excursion beyond each target before the error first crosses zero
+/// again on the way back; oscillation is the largest error after that, or at
+/// any time while an oscillator is running, so a ringing or modulated axis is
+/// not mistaken for an overshooting one.
+///
+/// Usage:
+///   gesture_sim [-j processes] [-t tick-usec] [-m max-sec] script...
+///
+/// Build from this directory with e.g.:
+///   g++ -std=gnu++11 -O2 -Inative -I../StepperWinch -o gesture_sim gesture_sim.cpp native/Arduino.cpp ../StepperWinch/*.cpp
+
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The sketch is compiled into this file so that its channel objects can be
+// inspected directly.
+#include "native/Sketch.cpp"
+
+/// Number of channels in a gesture.
+#define CHANNELS 4
+
+/// Positional and velocity tolerance for considering an axis settled.
+#define SETTLE_POSITION 0.5
+#define SETTLE_VELOCITY 1.0
+
+/// Fraction of a limit at which an axis is considered saturated.
+#define SATURATION_FRACTION 0.999
+
+/// Fixed-point precision used to read back the model state.
+#define STATE_BITS 8
+
+/// Channel objects of the sketch, in channel order.
+static Path *const paths[CHANNELS] = { &x_path, &y_path, &z_path, &a_path };
+static Spline *const splines[CHANNELS] = { &x_spline, &y_spline, &z_spline, &a_spline };
+static Oscillator *const oscillators[CHANNELS] = { &x_oscillator, &y_oscillator, &z_oscillator, &a_oscillator };
+
+/// Simulation parameters shared by all workers.
+static unsigned long tick_usec = 1000;
+static double max_seconds = 600.0;
+
+/// Virtual time in microseconds.
+static unsigned long virtual_now = 0;
+static unsigned long virtual_clock(void) { return virtual_now; }
+
+// ================================================================
+/// Result of evaluating one script.
+struct GestureResult {
+  double duration;        ///< time until all axes settled, in seconds
+  double peak_velocity;   ///< largest absolute velocity, steps/sec
+  double peak_accel;      ///< largest absolute acceleration, steps/sec/sec
+  double saturated;       ///< time with any axis at a limit, in seconds
+  double overshoot;       ///< largest first excursion past a finite target, in steps
+  double oscillation;     ///< largest error once the first excursion has ended, in steps
+  bool timeout;           ///< true if the axes had not settled by the time limit
+};
+
+// ================================================================
+/// Progress of an axis response to its target, for separating overshoot from
+/// oscillation.
+enum Excursion { APPROACHING, OVERSHOOTING, RINGING };
+
+// ================================================================
+/// Simulation of one gesture script.  Only one may exist per process.
+class GestureSim {
+private:
+  const char *filename;
+  int line_number;
+  unsigned long next_tick;
+  double last_velocity[CHANNELS];
+  double target[CHANNELS];     ///< last finite target, or NAN during velocity mode
+  double start[CHANNELS];      ///< position at the time the target was set
+  Excursion excursion[CHANNELS]; ///< progress of the response to the target
+  double time;
+  GestureResult result;
+
+  double position(int i) { return ldexp(paths[i]->currentPositionFixed(STATE_BITS), -STATE_BITS); }
+  double velocity(int i) { return ldexp(paths[i]->currentVelocityFixed(STATE_BITS), -STATE_BITS); }
+
+  /// Report the firmware's debugging messages and discard the rest of its output.
+  void drain(void) {
+    size_t newline;
+    while ((newline = Serial.tx.find('\n')) != std::string::npos) {
+      std::string line = Serial.tx.substr(0, newline);
+      if (!line.compare(0, 4, "dbg ")) fprintf(stderr, "%s:%d: %s\n", filename, line_number, line.c_str() + 4);
+      Serial.tx.erase(0, newline + 1);
+    }
+  }
+
+public:
+  GestureSim(const char *_filename) : filename(_filename), line_number(0), time(0.0) {
+    result = GestureResult();
+    for (int i = 0; i < CHANNELS; i++) { last_velocity[i] = 0.0; target[i] = 0.0; start[i] = 0.0; excursion[i] = APPROACHING; }
+    native_clock = virtual_clock;
+    setup();
+    next_tick = virtual_now + Timer1.period;
+    drain();
+  }
+
+  /// Advance the sketch by one tick and accumulate the metrics.
+  void step(void);
+
+  /// Return true if every axis is at rest at its target with no modulation.
+  bool settled(void) {
+    for (int i = 0; i < CHANNELS; i++) {
+      if (isnan(target[i]) || splines[i]->isActive() || oscillators[i]->isActive()) return false;
+      if (fabs(position(i) - target[i]) > SETTLE_POSITION || fabs(velocity(i)) > SETTLE_VELOCITY) return false;
+    }
+    return true;
+  }
+
+  /// Apply one script line.
+  void command(char *line);
+
+  /// Run a script file to completion.  Returns false if it cannot be read.
+  bool run(GestureResult *result);
+};
+
+// ================================================================
+void GestureSim::step(void)
+{
+  double dt = 1e-6 * tick_usec;
+  bool saturated = false;
+
+  loop();
+  drain();
+  unsigned long until = virtual_now + tick_usec;
+  while ((long) (until - next_tick) >= 0) {
+    virtual_now = next_tick;
+    if (Timer1.handler) Timer1.handler();
+    next_tick += Timer1.period;
+  }
+  virtual_now = until;
+
+  for (int i = 0; i < CHANNELS; i++) {
+    double q = position(i), qd = velocity(i);
+    double qdd = (qd - last_velocity[i]) / dt;
+    last_velocity[i] = qd;
+
+    result.peak_velocity = fmax(result.peak_velocity, fabs(qd));
+    result.peak_accel    = fmax(result.peak_accel, fabs(qdd));
+
+    if (fabs(qd) >= SATURATION_FRACTION * paths[i]->velocityLimit() ||
+	fabs(qdd) >= SATURATION_FRACTION * paths[i]->accelerationLimit()) saturated = true;
+
+    // Track the target set by the firmware, as confined by the soft limits; a
+    // new one restarts the overshoot measurement from the present position.
+    // Until the last leg of a waypoint sequence the start moves along too.
+    double goal = NAN;
+    if (paths[i]->hasTarget())
+      goal = constrain((double) paths[i]->targetPosition(), paths[i]->lowerPositionLimit(), paths[i]->upperPositionLimit());
+    bool transit = paths[i]->pendingWaypoints() > 1;
+    if (transit || isnan(goal) != isnan(target[i]) || (!isnan(goal) && goal != target[i])) {
+      target[i] = goal;
+      start[i] = q;
+      excursion[i] = APPROACHING;
+    }
+
+    // Overshoot is measured beyond the target in the direction of travel, up
+    // to the point at which the error changes sign again.  Any later error,
+    // or error while an oscillator modulates the axis, is oscillation.
+    if (!isnan(target[i]) && !transit) {
+      double excess = (target[i] >= start[i]) ? (q - target[i]) : (target[i] - q);
+      if (oscillators[i]->isActive()) excursion[i] = RINGING;
+      else if (excursion[i] == APPROACHING && excess > 0.0) excursion[i] = OVERSHOOTING;
+      else if (excursion[i] == OVERSHOOTING && excess <= 0.0) excursion[i] = RINGING;
+
+      if (excursion[i] == OVERSHOOTING) result.overshoot = fmax(result.overshoot, excess);
+      else if (excursion[i] == RINGING) result.oscillation = fmax(result.oscillation, fabs(excess));
+    }
+  }
+  if (saturated) result.saturated += dt;
+  time += dt;
+}
+
+// ================================================================
+void GestureSim::command(char *line)
+{
+  char copy[256], *save;
+  strncpy(copy, line, sizeof(copy) - 1);
+  copy[sizeof(copy) - 1] = 0;
+
+  char *first = strtok_r(copy, " \t\r\n", &save);
+  if (!first || first[0] == '#') return;
+
+  if (!strcmp(first, "wait")) {
+    char *value = strtok_r(NULL, " \t\r\n", &save);
+    if (value) {
+      double until = time + 1e-3 * atof(value);
+      while (time < until) step();
+    }
+    return;
+  }
+
+  // Deliver the line to the firmware and run until it has been consumed.
+  for (char *c = line; *c && *c != '\r' && *c != '\n'; c++) Serial.rx.push_back(*c);
+  Serial.rx.push_back('\n');
+  while (!Serial.rx.empty()) step();
+}
+
+// ================================================================
+bool GestureSim::run(GestureResult *output)
+{
+  FILE *file = fopen(filename, "r");
+  if (!file) return false;
+
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    line_number++;
+    command(line);
+  }
+  fclose(file);
+
+  while (!settled() && time < max_seconds) step();
+
+  result.duration = time;
+  result.timeout = !settled();
+  *output = result;
+  return true;
+}
+
+// ================================================================
+/// Evaluate one script in a child process which writes its result line to
+/// the given descriptor.  Returns the child's process id, or -1 on error.
+static pid_t spawn(const char *filename, int *fd)
+{
+  int result[2];
+  if (pipe(result) < 0) return -1;
+  fflush(stdout);
+  fflush(stderr);
+
+  pid_t pid = fork();
+  if (pid < 0) return -1;
+  if (pid == 0) {
+    close(result[0]);
+    GestureResult r;
+    GestureSim sim(filename);
+    if (!sim.run(&r)) {
+      fprintf(stderr, "%s: cannot open\n", filename);
+      _exit(1);
+    }
+    dprintf(result[1], "%s %.3f %.1f %.1f %.3f %.2f %.2f%s\n", filename, r.duration, r.peak_velocity, r.peak_accel,
+	    r.saturated, r.overshoot, r.oscillation, r.timeout ? " timeout" : "");
+    _exit(0);
+  }
+  close(result[1]);
+  *fd = result[0];
+  return pid;
+}
+
+/// Wait for one child to exit and collect its result line.  Returns false on failure.
+static bool reap(std::map<pid_t, int> &running, std::vector<std::string> &results, std::map<pid_t, size_t> &index)
+{
+  int status;
+  pid_t pid = wait(&status);
+  if (pid < 0 || !running.count(pid)) return false;
+
+  char buffer[512];
+  ssize_t length;
+  std::string &text = results[index[pid]];
+  while ((length = read(running[pid], buffer, sizeof(buffer))) > 0) text.append(buffer, length);
+  close(running[pid]);
+  running.erase(pid);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// ================================================================
+int main(int argc, char **argv)
+{
+  int processes = std::thread::hardware_concurrency();
+  int opt;
+
+  while ((opt = getopt(argc, argv, "j:t:m:")) != -1) {
+    switch (opt) {
+    case 'j': processes = atoi(optarg); break;
+    case 't': tick_usec = strtoul(optarg, NULL, 10); break;
+    case 'm': max_seconds = atof(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-j processes] [-t tick-usec] [-m max-sec] script...\n", argv[0]);
+      return 1;
+    }
+  }
+  if (processes < 1) processes = 1;
+  if (tick_usec == 0) tick_usec = 1;
+
+  std::vector<const char *> files(argv + optind, argv + argc);
+  std::vector<std::string> results(files.size());
+  std::map<pid_t, int> running;
+  std::map<pid_t, size_t> index;
+  int status = 0;
+
+  // Keep up to the given number of scripts running until none remain.
+  for (size_t i = 0; i < files.size(); i++) {
+    if ((int) running.size() == processes && !reap(running, results, index)) status = 1;
+    int fd;
+    pid_t pid = spawn(files[i], &fd);
+    if (pid < 0) { perror("spawn"); return 1; }
+    running[pid] = fd;
+    index[pid] = i;
+  }
+  while (!running.empty()) if (!reap(running, results, index)) status = 1;
+
+  for (size_t i = 0; i < files.size(); i++) fputs(results[i].c_str(), stdout);
+  return status;
+}
+//================================================================
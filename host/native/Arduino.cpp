@@ -0,0 +1,91 @@
+/// \file Arduino.cpp
+/// \brief Minimal Arduino API for building the StepperWinch sketch natively.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "TimerOne.h"
+
+static unsigned long zero_clock(void) { return 0; }
+
+unsigned long (*native_clock)(void) = zero_clock;
+void (*native_pin_hook)(uint8_t pin, uint8_t level) = NULL;
+uint8_t native_pin_level[NATIVE_PINS];
+
+NativeSerial Serial;
+NativeEEPROM EEPROM;
+TimerOne Timer1;
+
+//================================================================
+unsigned long micros(void) { return native_clock(); }
+unsigned long millis(void) { return native_clock() / 1000; }
+
+// Busy waits are not modeled; the virtual clock only advances in the harness.
+void delay(unsigned long ms) { (void) ms; }
+void delayMicroseconds(unsigned int us) { (void) us; }
+
+//================================================================
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  // Pull-ups read high until a harness drives the input low.
+  if (pin < NATIVE_PINS && mode == INPUT_PULLUP) native_pin_level[pin] = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level)
+{
+  if (pin >= NATIVE_PINS) return;
+  level = (level != 0);
+  if (native_pin_level[pin] != level) {
+    native_pin_level[pin] = level;
+    if (native_pin_hook) native_pin_hook(pin, level);
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  return (pin < NATIVE_PINS) ? native_pin_level[pin] : LOW;
+}
+
+void analogWrite(uint8_t pin, int value)
+{
+  digitalWrite(pin, value > 127);
+}
+
+//================================================================
+int NativeSerial::read(void)
+{
+  if (rx.empty()) return -1;
+  int c = rx.front();
+  rx.pop_front();
+  return c;
+}
+
+void NativeSerial::print(long value)
+{
+  char buffer[24];
+  snprintf(buffer, sizeof(buffer), "%ld", value);
+  tx += buffer;
+}
+
+void NativeSerial::print(unsigned long value)
+{
+  char buffer[24];
+  snprintf(buffer, sizeof(buffer), "%lu", value);
+  tx += buffer;
+}
+
+void NativeSerial::print(double value, int digits)
+{
+  char buffer[40];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+  tx += buffer;
+}
+//================================================================
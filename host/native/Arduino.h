@@ -0,0 +1,124 @@
+/// \file Arduino.h
+/// \brief Minimal Arduino API for building the StepperWinch sketch natively.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details This header stands in for the Arduino core so that the sketch
+/// sources compile unchanged on a host.  The clock is supplied by the harness
+/// (virtual or real time), output pin changes are forwarded to an optional
+/// trace hook, and the serial port is a pair of byte queues.  Only the
+/// functions used by the sketch are provided.
+
+#ifndef __NATIVE_ARDUINO_H_INCLUDED__
+#define __NATIVE_ARDUINO_H_INCLUDED__
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <deque>
+#include <string>
+
+#define HIGH 1
+#define LOW  0
+
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+
+#define LED_BUILTIN 13
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+// Program memory is ordinary memory on the host.
+#define PROGMEM
+#define PSTR(str) (str)
+#define F(str) ((const __FlashStringHelper *) (str))
+#define pgm_read_byte(addr) (*(const uint8_t *) (addr))
+#define pgm_read_word(addr) (*(const uint16_t *) (addr))
+#define strcmp_P strcmp
+#define strchr_P strchr
+typedef const char *PGM_P;
+class __FlashStringHelper;
+#define bit(b) (1UL << (b))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+template<class T, class U> static inline auto min(T a, U b) -> decltype(a + b) { return (a < b) ? a : b; }
+template<class T, class U> static inline auto max(T a, U b) -> decltype(a + b) { return (a > b) ? a : b; }
+
+/// Number of simulated digital pins.
+#define NATIVE_PINS 20
+
+/// Clock source used by micros() and millis(), in microseconds.
+extern unsigned long (*native_clock)(void);
+
+/// Optional hook called on every change of an output pin level.
+extern void (*native_pin_hook)(uint8_t pin, uint8_t level);
+
+/// Current simulated pin levels; inputs may be set directly by a harness.
+extern uint8_t native_pin_level[NATIVE_PINS];
+
+unsigned long micros(void);
+unsigned long millis(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+
+static inline void noInterrupts(void) {}
+static inline void interrupts(void) {}
+
+// ================================================================
+/// Serial port model.  The harness appends received bytes to rx and drains
+/// transmitted bytes from tx.
+class NativeSerial {
+public:
+  std::deque<uint8_t> rx;      ///< bytes waiting to be read by the sketch
+  std::string tx;              ///< bytes written by the sketch
+  long baud;                   ///< most recent begin() rate
+
+  NativeSerial() : baud(0) {}
+
+  void begin(long rate) { baud = rate; }
+  void end(void) {}
+  void flush(void) {}
+  int available(void) { return rx.size(); }
+  int availableForWrite(void) { return 63; }
+  int read(void);
+  int peek(void) { return rx.empty() ? -1 : rx.front(); }
+
+  size_t write(uint8_t c) { tx += (char) c; return 1; }
+  void print(const char *str) { tx += str; }
+  void print(const __FlashStringHelper *str) { tx += (const char *) str; }
+  void print(char c) { tx += c; }
+  void print(int value) { print((long) value); }
+  void print(unsigned int value) { print((unsigned long) value); }
+  void print(long value);
+  void print(unsigned long value);
+  void print(double value, int digits = 2);
+
+  template<class T> void println(T value) { print(value); tx += "\r\n"; }
+  void println(void) { tx += "\r\n"; }
+};
+
+extern NativeSerial Serial;
+
+#endif //__NATIVE_ARDUINO_H_INCLUDED__
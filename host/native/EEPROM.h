@@ -0,0 +1,36 @@
+/// \file EEPROM.h
+/// \brief Native stand-in for the Arduino EEPROM library.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details The memory starts erased (all bytes 0xFF) and is not saved
+/// between runs; writes complete immediately.
+
+#ifndef __NATIVE_EEPROM_H_INCLUDED__
+#define __NATIVE_EEPROM_H_INCLUDED__
+
+#include <stdint.h>
+#include <string.h>
+
+/// Size of the simulated EEPROM, as on the ATmega328P.
+#define NATIVE_EEPROM_SIZE 1024
+
+class NativeEEPROM {
+public:
+  uint8_t data[NATIVE_EEPROM_SIZE];   ///< memory contents
+
+  NativeEEPROM() { memset(data, 0xff, sizeof(data)); }
+  uint8_t read(int address) { return (address >= 0 && address < NATIVE_EEPROM_SIZE) ? data[address] : 0xff; }
+  void write(int address, uint8_t value) { if (address >= 0 && address < NATIVE_EEPROM_SIZE) data[address] = value; }
+  void update(int address, uint8_t value) { write(address, value); }
+  uint16_t length(void) { return NATIVE_EEPROM_SIZE; }
+};
+
+extern NativeEEPROM EEPROM;
+
+#endif //__NATIVE_EEPROM_H_INCLUDED__
@@ -0,0 +1,92 @@
+/// \file Session.cpp
+/// \brief Compact binary log of timestamped protocol input lines.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+
+#include <string.h>
+
+#include "Session.h"
+
+static const char session_magic[4] = { 'S', 'W', 'R', '1' };
+
+//================================================================
+static void write_varint(FILE *file, unsigned long value)
+{
+  while (value >= 0x80) {
+    fputc((int) (value & 0x7f) | 0x80, file);
+    value >>= 7;
+  }
+  fputc((int) value, file);
+}
+
+static bool read_varint(FILE *file, unsigned long *value)
+{
+  unsigned long result = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = fgetc(file);
+    if (c == EOF) return false;
+    result |= (unsigned long) (c & 0x7f) << shift;
+    if (!(c & 0x80)) { *value = result; return true; }
+  }
+  return false;
+}
+
+//================================================================
+bool SessionWriter::open(const char *path)
+{
+  close();
+  file = fopen(path, "wb");
+  if (!file) return false;
+  fwrite(session_magic, 1, sizeof(session_magic), file);
+  last_usec = 0;
+  return true;
+}
+
+void SessionWriter::write(unsigned long usec, const std::string &line)
+{
+  if (!file) return;
+  write_varint(file, usec - last_usec);
+  write_varint(file, line.size());
+  fwrite(line.data(), 1, line.size(), file);
+  last_usec = usec;
+}
+
+void SessionWriter::close(void)
+{
+  if (file) fclose(file);
+  file = NULL;
+}
+
+//================================================================
+bool SessionReader::open(const char *path)
+{
+  char magic[sizeof(session_magic)];
+  file = fopen(path, "rb");
+  if (!file) return false;
+  if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, session_magic, sizeof(magic))) {
+    fclose(file);
+    file = NULL;
+    return false;
+  }
+  last_usec = 0;
+  return true;
+}
+
+bool SessionReader::read(unsigned long *usec, std::string *line)
+{
+  unsigned long delta, length;
+  if (!file || !read_varint(file, &delta) || !read_varint(file, &length)) return false;
+
+  line->resize(length);
+  if (length > 0 && fread(&(*line)[0], 1, length, file) != length) return false;
+
+  last_usec += delta;
+  *usec = last_usec;
+  return true;
+}
+//================================================================
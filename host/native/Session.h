@@ -0,0 +1,61 @@
+/// \file Session.h
+/// \brief Compact binary log of timestamped protocol input lines.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details A session file begins with the four bytes "SWR1".  Each record
+/// then holds the time in microseconds since the previous record and the line
+/// length, both as unsigned LEB128 varints, followed by the line text without
+/// terminator.  A typical command line costs two bytes of overhead.
+
+#ifndef __SESSION_H_INCLUDED__
+#define __SESSION_H_INCLUDED__
+
+#include <stdio.h>
+#include <string>
+
+// ================================================================
+/// Writer for a session file.
+class SessionWriter {
+private:
+  FILE *file;                  ///< output stream, or NULL if closed
+  unsigned long last_usec;     ///< timestamp of the previous record
+
+public:
+  SessionWriter() : file(NULL), last_usec(0) {}
+  ~SessionWriter() { close(); }
+
+  /// Create the file and write the header.  Returns false on error.
+  bool open(const char *path);
+
+  /// Append a line which arrived at the given micros() value.
+  void write(unsigned long usec, const std::string &line);
+
+  /// Flush and close the file.
+  void close(void);
+};
+
+// ================================================================
+/// Reader for a session file.
+class SessionReader {
+private:
+  FILE *file;                  ///< input stream, or NULL if closed
+  unsigned long last_usec;     ///< timestamp of the previous record
+
+public:
+  SessionReader() : file(NULL), last_usec(0) {}
+  ~SessionReader() { if (file) fclose(file); }
+
+  /// Open the file and check the header.  Returns false on error.
+  bool open(const char *path);
+
+  /// Read the next record.  Returns false at the end of the file.
+  bool read(unsigned long *usec, std::string *line);
+};
+
+#endif //__SESSION_H_INCLUDED__
@@ -0,0 +1,25 @@
+/// \file Sketch.cpp
+/// \brief Native compilation unit for the StepperWinch sketch files.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details The Arduino IDE concatenates the .ino files and generates function
+/// prototypes.  Here the I/O file is included first so that its utility
+/// functions are declared before use, which leaves only the parser entry
+/// points to be declared in advance.  The sketch .cpp modules are compiled separately.
+
+#include <Arduino.h>
+#include "NumberScanner.h"
+
+void parse_input_message(int argc, char *argv[], NumberScanner argn[]);
+bool stream_begin(char *command, char *flags);
+bool stream_argument(int index, NumberScanner *number);
+void stream_end(int count);
+
+#include "../../StepperWinch/serial_input_output.ino"
+#include "../../StepperWinch/StepperWinch.ino"
@@ -0,0 +1,30 @@
+/// \file TimerOne.h
+/// \brief Native stand-in for the TimerOne library.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details The harness is responsible for calling the attached handler once
+/// per period; nothing runs asynchronously.
+
+#ifndef __NATIVE_TIMERONE_H_INCLUDED__
+#define __NATIVE_TIMERONE_H_INCLUDED__
+
+class TimerOne {
+public:
+  unsigned long period;        ///< interrupt period in microseconds
+  void (*handler)(void);       ///< attached interrupt handler, or NULL
+
+  TimerOne() : period(1000), handler(0) {}
+  void initialize(unsigned long microseconds) { period = microseconds; }
+  void attachInterrupt(void (*isr)(void)) { handler = isr; }
+  void setPeriod(unsigned long microseconds) { period = microseconds; }
+};
+
+extern TimerOne Timer1;
+
+#endif //__NATIVE_TIMERONE_H_INCLUDED__
@@ -0,0 +1,133 @@
+/// \file client_pty_test.cpp
+/// \brief Test of WinchClient against the native firmware build over a pseudo-terminal.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details This program starts winch_native in live mode, attaches to the
+/// pseudo-terminal it reports, and drives it with WinchClient exactly as a
+/// board on a serial port.  It checks that status reports are decoded, that
+/// numbered lines are acknowledged with ack or nak as appropriate, that a
+/// line rate negotiation completes, and that once the firmware process exits
+/// the hangup is reported and the worker thread goes idle rather than spinning
+/// on the level-triggered EPOLLHUP.  Each check prints one line; the exit
+/// status is 0 if all passed.
+///
+/// Usage:
+///   client_pty_test [path-to-winch_native]
+///
+/// Build from this directory, after winch_native, with e.g.:
+///   g++ -std=gnu++11 -O2 -pthread -I.. -o client_pty_test client_pty_test.cpp ../WinchClient.cpp -lutil
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "WinchClient.h"
+
+/// Number of checks failed.
+static int failures = 0;
+
+//================================================================
+static void check(bool passed, const char *name)
+{
+  printf("%s %s\n", passed ? "pass" : "FAIL", name);
+  if (!passed) failures++;
+}
+
+/// Wait up to the given time for a condition to become true.
+template<class F> static bool wait_for(F condition, double seconds)
+{
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+  while (!condition()) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return true;
+}
+
+/// Return the CPU time used by this process in seconds.
+static double cpu_time(void)
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+//================================================================
+int main(int argc, char **argv)
+{
+  const char *program = (argc > 1) ? argv[1] : "./winch_native";
+
+  // Start the firmware, which prints the pseudo-terminal name on stderr.
+  int report[2];
+  if (pipe(report) < 0) { perror("pipe"); return 1; }
+  pid_t pid = fork();
+  if (pid < 0) { perror("fork"); return 1; }
+  if (pid == 0) {
+    dup2(report[1], STDERR_FILENO);
+    close(report[0]);
+    close(report[1]);
+    execl(program, program, (char *) NULL);
+    _exit(127);
+  }
+  close(report[1]);
+
+  char name[64];
+  FILE *stream = fdopen(report[0], "r");
+  if (!stream || !fgets(name, sizeof(name), stream)) { fprintf(stderr, "cannot start %s\n", program); return 1; }
+  name[strcspn(name, "\r\n")] = 0;
+
+  WinchClient client(1);
+  int board = client.addBoard(name);
+  if (board < 0) { perror(name); kill(pid, SIGTERM); return 1; }
+  client.setAcknowledged(board, true);
+
+  std::atomic<int> status_count(0), acks(0), naks(0), confirmed_baud(0), disconnects(0);
+  std::atomic<long> last_position(0);
+  client.onStatus([&](int, const WinchStatus &status) { status_count++; last_position = status.position[0]; });
+  client.onAck([&](int, long, bool applied) { if (applied) acks++; else naks++; });
+  client.onBaud([&](int, long rate, bool confirmed) { if (confirmed) confirmed_baud = rate; });
+  client.onDisconnect([&](int) { disconnects++; });
+  client.start();
+
+  // Numbered commands, one of them malformed.
+  client.send(board, "a x 100");
+  client.send(board, "a x 100 bad");
+  client.send(board, "r y 10");
+  check(wait_for([&]() { return acks + naks == 3; }, 2.0), "all lines answered");
+  check(acks == 2 && naks == 1, "malformed line rejected");
+  check(wait_for([&]() { return status_count > 0 && last_position == 100; }, 3.0), "status reports decoded");
+
+  // A faster line rate; the pty accepts any rate.
+  client.setBaud(board, 250000);
+  client.send(board, "d x 10");
+  check(wait_for([&]() { return confirmed_baud == 250000; }, 3.0), "line rate negotiated");
+  check(wait_for([&]() { return acks == 3; }, 2.0), "line acknowledged after rate change");
+
+  // Hang up the device by ending the firmware process.
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  check(wait_for([&]() { return disconnects == 1; }, 2.0), "hangup reported");
+  check(!client.isConnected(board), "board marked disconnected");
+
+  double start = cpu_time();
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  check(cpu_time() - start < 0.1, "worker idle after hangup");
+
+  client.stop();
+  fclose(stream);
+  return failures ? 1 : 0;
+}
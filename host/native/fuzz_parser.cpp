@@ -0,0 +1,517 @@
+/// \file fuzz_parser.cpp
+/// \brief libFuzzer target for the StepperWinch command parser.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details The fuzzer input is not sent to the sketch as raw text, since
+/// almost every random line would fail at the first token.  Instead each
+/// input is decoded by a small grammar into a sequence of operations: command
+/// lines built from the real command names, flag sets and numbers of every
+/// shape the parser must handle (small, large, overflowing, fractional and
+/// malformed), with occasional missing or surplus arguments, bad flags,
+/// sequence number prefixes and raw byte lines; and advances of the virtual
+/// clock.  Every line is delivered through the serial port model in chunks of
+/// decoded size, so both parse_input_message() and the streaming path used
+/// for motion commands see it split at arbitrary points.
+///
+/// Before the first input, the number scanner is checked against a table of
+/// tokens with known results, such as "1." which is a float but not an
+/// integer.  Besides the sanitizers, two properties are checked after every line
+/// delivered while the clock is stopped: a line answered with 'dbg' or 'nak'
+/// changes no channel settings, and an accepted line which names a flag set
+/// changes no channel outside it.  A violation prints the line and aborts.
+/// The sketch is rebuilt from its initial state at the start of each input so
+/// that every input is reproducible on its own.
+///
+/// Build with libFuzzer from this directory with e.g.:
+///   clang++ -std=gnu++11 -g -O1 -fsanitize=fuzzer,address,undefined -I. -I../../StepperWinch -o fuzz_parser fuzz_parser.cpp Arduino.cpp ../../StepperWinch/*.cpp
+///   ./fuzz_parser fuzz_corpus
+///
+/// Without libFuzzer, FUZZ_STANDALONE adds a main() which runs the named
+/// corpus files, or random inputs, and can regenerate the seed corpus:
+///   g++ -std=gnu++11 -O1 -DFUZZ_STANDALONE -fsanitize=address,undefined -I. -I../../StepperWinch -o fuzz_parser fuzz_parser.cpp Arduino.cpp ../../StepperWinch/*.cpp
+///   fuzz_parser [-v] [-n random-inputs] [-r seed] [-g corpus-dir] [file...]
+/// where -v prints each line delivered and the sketch's reply.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+// The sketch is compiled into this file so that its state can be reset and inspected.
+#include "Sketch.cpp"
+#include "EEPROM.h"
+
+// ================================================================
+// Grammar tables.
+
+/// A command name and the shape of its arguments: F flag set, N one number
+/// per flag, n number, w word, @ a nested command line.
+struct CommandForm {
+  const char *name;
+  const char *args;
+};
+
+static const CommandForm forms[] = {
+  { "a", "FN" }, { "d", "FN" }, { "r", "FN" }, { "v", "FN" }, { "s", "FN" }, { "w", "FN" }, { "k", "FN" },
+  { "g", "Fnn" }, { "l", "Fnn" }, { "index", "Fn" }, { "home", "F" }, { "encoder", "Fnnn" },
+  { "spline", "Fn" }, { "play", "F" }, { "play", "nF" }, { "store", "nFn" }, { "store", "w" },
+  { "erase", "n" }, { "gestures", "" }, { "report", "Fn" }, { "report", "Fw" },
+  { "settle", "Fnnn" }, { "settle", "Fw" }, { "limit", "Fnn" }, { "limit", "Fw" },
+  { "osc", "Fwnnnn" }, { "release", "Fn" }, { "enable", "n" }, { "version", "" }, { "ping", "" },
+  { "clock", "" }, { "sync", "nn" }, { "sync", "nnn" }, { "at", "n@" }, { "baud", "n" }, { "save", "" }, { "save", "w" },
+  { "load", "" }, { "power", "nn" }, { "srate", "n" }, { "bogus", "F" },
+};
+#define NUM_FORMS (sizeof(forms) / sizeof(forms[0]))
+
+static const char *const words[] = { "off", "sine", "tri", "noise", "clear", "end", "bogus", "" };
+
+static const char *const extreme_numbers[] = {
+  "2147483647", "-2147483648", "2147483648", "99999999999", "8000000", "-8000001", "0", "-0",
+  "5000", "5001", "60000", "65535",
+};
+
+static const char *const malformed_numbers[] = {
+  "1O", "--3", "+", "-", "1e", "0x10", ".", "1.2.3", "abc", "5k", "1e99", "nan", "1.", "-7.",
+};
+
+/// Tokens with the results the number scanner must give for them, checked
+/// once before the first input: whether each conversion accepts the token,
+/// and the value it yields if so.
+static const struct { const char *token; bool is_long; long integer; bool is_float; float real; } scanner_cases[] = {
+  { "0", true, 0, true, 0.0f },                    { "-0", true, 0, true, 0.0f },
+  { "+12", true, 12, true, 12.0f },                { "2147483647", true, 2147483647L, true, 2147483647.0f },
+  { "-2147483648", true, -2147483647L - 1, true, -2147483648.0f },
+  { "2147483648", false, 0, true, 2147483648.0f }, { "1.", false, 0, true, 1.0f },
+  { "-7.", false, 0, true, -7.0f },                { "1.0", false, 0, true, 1.0f },
+  { ".5", false, 0, true, 0.5f },                  { "-.25", false, 0, true, -0.25f },
+  { ".", false, 0, false, 0.0f },                  { "-", false, 0, false, 0.0f },
+  { "1.2.3", false, 0, false, 0.0f },              { "1e3", false, 0, false, 0.0f },
+  { "4294967296", false, 0, false, 0.0f },         { "", false, 0, false, 0.0f },
+};
+
+#define ENTRIES(table) (sizeof(table) / sizeof(table[0]))
+
+// ================================================================
+/// Sequential reader of the fuzzer input.  Reads past the end return zero.
+class FuzzInput {
+private:
+  const uint8_t *data;
+  size_t size, offset;
+
+public:
+  FuzzInput(const uint8_t *_data, size_t _size) : data(_data), size(_size), offset(0) {}
+  bool done(void) { return offset >= size; }
+  uint8_t byte(void) { return (offset < size) ? data[offset++] : 0; }
+  long word(void) { return (int16_t) (byte() | (byte() << 8)); }
+  long dword(void) { return (int32_t) ((uint32_t) word() << 16 | (uint16_t) word()); }
+};
+
+/// Append one number token in a shape chosen by the input.
+static void add_number(FuzzInput &in, std::string &line)
+{
+  char buffer[32];
+  switch (in.byte() % 8) {
+  case 0:  snprintf(buffer, sizeof(buffer), "%d", (int) in.byte() - 128); break;
+  case 1:  snprintf(buffer, sizeof(buffer), "%ld", in.word()); break;
+  case 2:  snprintf(buffer, sizeof(buffer), "%ld", in.dword()); break;
+  case 3:  snprintf(buffer, sizeof(buffer), "%s", extreme_numbers[in.byte() % ENTRIES(extreme_numbers)]); break;
+  case 4:  snprintf(buffer, sizeof(buffer), "%ld.%u", in.word(), in.byte()); break;
+  case 5:  snprintf(buffer, sizeof(buffer), "%s", malformed_numbers[in.byte() % ENTRIES(malformed_numbers)]); break;
+  default: snprintf(buffer, sizeof(buffer), "%u", in.byte()); break;
+  }
+  line += buffer;
+}
+
+/// Append a flag set chosen by the input; returns the mask of the channels it
+/// names, or -1 if it is deliberately invalid.
+static int add_flags(FuzzInput &in, std::string &line)
+{
+  uint8_t choice = in.byte();
+  int mask = choice & 15;
+  if (mask == 0) mask = 1;
+
+  // Rotate the letter order so flag sets are not always in channel order.
+  int rotate = (choice >> 4) & 3;
+  for (int i = 0; i < 4; i++) {
+    int channel = (i + rotate) % 4;
+    if (mask & (1 << channel)) line += "xyza"[channel];
+  }
+  if ((choice >> 6) == 3) {
+    line += (choice & 32) ? 'x' : 'q';
+    return -1;
+  }
+  return mask;
+}
+
+/// Build one command line from the input.  Sets the mask of named channels,
+/// or -1 if the line names none or is deliberately invalid.
+static std::string make_line(FuzzInput &in, int *named, int depth = 0)
+{
+  std::string line;
+  const CommandForm &form = forms[in.byte() % NUM_FORMS];
+  uint8_t variant = in.byte();
+  int mask = 0, flags = 0;
+
+  if (depth == 0 && (variant & 7) == 0) {
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "@%u ", in.byte());
+    line += buffer;
+  }
+  line += form.name;
+
+  // Commands without a flag set name no channel, except that 'load' and
+  // 'enable', which stops every channel when it disables the drivers, may
+  // legitimately change them all.
+  if (!strcmp(form.name, "load") || !strcmp(form.name, "enable")) mask = -1;
+
+  for (const char *arg = form.args; *arg; arg++) {
+    line += ' ';
+    switch (*arg) {
+    case 'F': mask = add_flags(in, line); flags = (mask < 0) ? 1 : __builtin_popcount(mask); break;
+    case 'n': add_number(in, line); break;
+    case 'w': line += words[in.byte() % ENTRIES(words)]; break;
+    case '@': { int ignored; line += make_line(in, &ignored, depth + 1); mask = -1; } break;
+    case 'N':
+      for (int i = 0; i < flags; i++) {
+	if (i) line += ' ';
+	add_number(in, line);
+      }
+      break;
+    }
+  }
+
+  // Occasionally one argument too many or too few.
+  switch ((variant >> 3) & 15) {
+  case 0: line += ' '; add_number(in, line); mask = -1; break;
+  case 1: { size_t space = line.rfind(' '); if (space != std::string::npos) line.erase(space); mask = -1; } break;
+  default: break;
+  }
+  *named = mask;
+  return line;
+}
+
+// ================================================================
+// Sketch control.
+
+/// Virtual time in microseconds.
+static unsigned long virtual_now = 0;
+
+/// True to print each line delivered and the sketch's reply.
+static bool verbose = false;
+static unsigned long virtual_clock(void) { return virtual_now; }
+
+/// Rebuild the sketch objects in their initial state and run setup().
+static void reset_sketch(void)
+{
+  virtual_now = 0;
+  native_clock = virtual_clock;
+  Serial = NativeSerial();
+  EEPROM = NativeEEPROM();
+
+  // A partial line left by an earlier input is ended and discarded.
+  Serial.rx.push_back('\n');
+  serial_input_poll();
+  Serial.tx.clear();
+
+  x_axis = Stepper(X_AXIS_STEP_PIN, X_AXIS_DIR_PIN);
+  y_axis = Stepper(Y_AXIS_STEP_PIN, Y_AXIS_DIR_PIN);
+  z_axis = Stepper(Z_AXIS_STEP_PIN, Z_AXIS_DIR_PIN);
+  a_axis = Stepper(A_AXIS_STEP_PIN, A_AXIS_DIR_PIN);
+  x_monitor = AxisMonitor(&x_axis, X_LIMIT_PIN);
+  y_monitor = AxisMonitor(&y_axis, Y_LIMIT_PIN);
+  z_monitor = AxisMonitor(&z_axis, Z_LIMIT_PIN);
+  a_monitor = AxisMonitor(&a_axis, NO_PIN);
+  x_path = y_path = z_path = a_path = Path();
+  x_homing = Homing(&x_axis, &x_path, &x_monitor);
+  y_homing = Homing(&y_axis, &y_path, &y_monitor);
+  z_homing = Homing(&z_axis, &z_path, &z_monitor);
+  a_homing = Homing(&a_axis, &a_path, &a_monitor);
+  x_oscillator = Oscillator(&x_path);
+  y_oscillator = Oscillator(&y_path);
+  z_oscillator = Oscillator(&z_path);
+  a_oscillator = Oscillator(&a_path);
+  x_spline = Spline(&x_path);
+  y_spline = Spline(&y_path);
+  z_spline = Spline(&z_path);
+  a_spline = Spline(&a_path);
+  gestures = GestureLibrary();
+  x_report = y_report = z_report = a_report = PositionReport();
+  sync_clock = SyncClock();
+
+  schedule_count = schedule_head = 0;
+  status_poll_interval = 200000;
+  drivers_enabled = drivers_holding = false;
+  driver_idle_time = 0;
+  driver_idle_timer = driver_wake_timer = 0;
+  message_sequence = -1;
+  message_error = 0;
+  baud_default = baud_rate = baud_previous = baud_pending = baud_trial_start = 0;
+  baud_trial = false;
+
+  setup();
+  Serial.tx.clear();
+}
+
+/// Run the sketch for the given time, with the timer handler at its period.
+static void advance(unsigned long usec)
+{
+  unsigned long until = virtual_now + usec;
+  while ((long) (until - virtual_now) > 0) {
+    loop();
+    for (unsigned long tick = 0; tick < 10 && (long) (until - virtual_now) > 0; tick++) {
+      virtual_now += Timer1.period;
+      if (Timer1.handler) Timer1.handler();
+    }
+  }
+  Serial.tx.clear();
+}
+
+/// Channel settings which a command may change.  The waypoint queue is left
+/// out, since the path retires a final waypoint on its own.
+struct ChannelState {
+  bool has_target;
+  long target;
+  float k, b, qd_max, qdd_max, speed, q_min, q_max;
+
+  void read(Path *p) {
+    has_target = p->hasTarget();
+    target = has_target ? p->targetPosition() : 0;
+    k = p->proportionalGain();
+    b = p->derivativeGain();
+    qd_max = p->velocityLimit();
+    qdd_max = p->accelerationLimit();
+    speed = p->rampSpeed();
+    q_min = p->lowerPositionLimit();
+    q_max = p->upperPositionLimit();
+  }
+  bool operator==(const ChannelState &o) const {
+    // Compare bitwise so that NaN and infinite settings match themselves.
+    return has_target == o.has_target && target == o.target && !memcmp(&k, &o.k, 7 * sizeof(float));
+  }
+};
+
+static Path *const paths[NUM_AXES] = { &x_path, &y_path, &z_path, &a_path };
+static Homing *const homings[NUM_AXES] = { &x_homing, &y_homing, &z_homing, &a_homing };
+
+/// Check the number scanner against the table of known tokens, reporting
+/// every mismatch.  Returns false if any was found.
+static bool check_scanner(void)
+{
+  bool ok = true;
+  for (size_t i = 0; i < ENTRIES(scanner_cases); i++) {
+    NumberScanner number;
+    long integer = 0;
+    float real = 0.0f;
+    number.scan(scanner_cases[i].token);
+    bool is_long = number.toLong(&integer), is_float = number.toFloat(&real);
+    if (is_long != scanner_cases[i].is_long || (is_long && integer != scanner_cases[i].integer)
+	|| is_float != scanner_cases[i].is_float || (is_float && real != scanner_cases[i].real)) {
+      fprintf(stderr, "scanner: '%s' gave %s %ld, %s %g\n", scanner_cases[i].token,
+	      is_long ? "long" : "no long", integer, is_float ? "float" : "no float", real);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+/// Report a property violation and stop.
+static void violation(const char *what, const std::string &line, int channel)
+{
+  fflush(stdout);
+  fprintf(stderr, "violation: %s on channel %c after '%s'\n", what, "xyza"[channel], line.c_str());
+  abort();
+}
+
+/// Deliver one line in chunks of a size chosen by the input with the clock
+/// stopped, and check its effect.
+static void deliver(FuzzInput &in, const std::string &line, int named)
+{
+  ChannelState before[NUM_AXES], after;
+  for (int i = 0; i < NUM_AXES; i++) before[i].read(paths[i]);
+  uint8_t scheduled = schedule_count;
+
+  std::string text = line + '\n';
+  size_t chunk = 1 + in.byte() % 32;
+  for (size_t sent = 0; sent < text.size(); ) {
+    for (size_t i = 0; i < chunk && sent < text.size(); i++) Serial.rx.push_back(text[sent++]);
+    while (!Serial.rx.empty()) loop();
+  }
+
+  bool rejected = Serial.tx.find("dbg ") != std::string::npos || Serial.tx.find("nak ") != std::string::npos;
+  if (verbose) printf("> %s\n%s", line.c_str(), Serial.tx.c_str());
+  Serial.tx.clear();
+
+  // A scheduled command run meanwhile may legitimately change anything.
+  if (schedule_count != scheduled) return;
+
+  for (int i = 0; i < NUM_AXES; i++) {
+    if (homings[i]->isActive()) continue;
+    after.read(paths[i]);
+    if (after == before[i]) continue;
+    if (rejected) violation("rejected line changed state", line, i);
+    if (named >= 0 && !(named & (1 << i))) violation("unnamed channel changed", line, i);
+  }
+}
+
+// ================================================================
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+  if (!check_scanner()) abort();
+  return 0;
+}
+
+// ================================================================
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  FuzzInput in(data, size);
+  reset_sketch();
+
+  while (!in.done()) {
+    uint8_t op = in.byte();
+    switch (op % 8) {
+    case 6:
+      // Let time pass, usually briefly.
+      advance((op & 8) ? 10000UL * in.byte() : 100UL * in.byte());
+      break;
+
+    case 7: {
+      // A raw line of arbitrary bytes, possibly overlong or with control codes.
+      std::string line;
+      for (int length = in.byte() % 100; length > 0; length--) {
+	char c = in.byte();
+	if (c != '\n' && c != '\r') line += c;
+      }
+      deliver(in, line, -1);
+    } break;
+
+    default: {
+      int named;
+      std::string line = make_line(in, &named);
+      deliver(in, line, named);
+    } break;
+    }
+  }
+  return 0;
+}
+
+// ================================================================
+#ifdef FUZZ_STANDALONE
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+
+/// Run one corpus file.  Returns false if it cannot be read.
+static bool run_file(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (!file) return false;
+  std::vector<uint8_t> data;
+  int c;
+  while ((c = fgetc(file)) != EOF) data.push_back(c);
+  fclose(file);
+  LLVMFuzzerTestOneInput(data.data(), data.size());
+  return true;
+}
+
+/// Run every file of a directory, or a single file.
+static bool run_path(const char *path)
+{
+  struct stat info;
+  if (stat(path, &info) < 0) return false;
+  if (!S_ISDIR(info.st_mode)) return run_file(path);
+
+  DIR *dir = opendir(path);
+  if (!dir) return false;
+  bool ok = true;
+  for (struct dirent *entry; (entry = readdir(dir)) != NULL; ) {
+    if (entry->d_name[0] == '.') continue;
+    std::string name = std::string(path) + "/" + entry->d_name;
+    ok = run_file(name.c_str()) && ok;
+  }
+  closedir(dir);
+  return ok;
+}
+
+/// Write a seed input, one per command form: the form with plain small
+/// numbers and valid flags, then a short advance of the clock.  Most are
+/// accepted; the rest reach the deeper checks of their command.
+static bool write_seeds(const char *dir)
+{
+  for (size_t i = 0; i < NUM_FORMS; i++) {
+    // op 0 selects a command line; variant 0x11 means no prefix and no
+    // argument change; each following number is a small positive integer.
+    std::vector<uint8_t> seed = { 0, (uint8_t) i, 0x11 };
+    for (const char *arg = forms[i].args; *arg; arg++) {
+      switch (*arg) {
+      case 'F': seed.push_back(0x03); break;      // xy
+      case 'N': for (int n = 0; n < 2; n++) { seed.push_back(7); seed.push_back(100); } break;
+      case 'n':                                   // 2, or -100 for the lower limit
+	if (!strcmp(forms[i].name, "limit") && arg == forms[i].args + 1) { seed.push_back(0); seed.push_back(28); }
+	else { seed.push_back(7); seed.push_back(2); }
+	break;
+      case 'w':                                   // sine, end, clear or off
+	if (!strcmp(forms[i].name, "osc")) seed.push_back(1);
+	else if (!strcmp(forms[i].name, "store")) seed.push_back(5);
+	else if (!strcmp(forms[i].name, "save")) seed.push_back(4);
+	else seed.push_back(0);
+	break;
+      case '@': seed.push_back(0); seed.push_back(0x11); seed.push_back(0x01); seed.push_back(7); seed.push_back(50); break;
+      }
+    }
+    seed.push_back(0);                            // deliver in one-byte chunks
+    seed.push_back(6);                            // then run for 25 msec
+    seed.push_back(250);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s/seed-%02u-%s", dir, (unsigned) i, forms[i].name);
+    FILE *file = fopen(name, "wb");
+    if (!file) return false;
+    fwrite(seed.data(), 1, seed.size(), file);
+    fclose(file);
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  long count = 0;
+  unsigned seed = 1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:r:g:v")) != -1) {
+    switch (opt) {
+    case 'v': verbose = true; break;
+    case 'n': count = atol(optarg); break;
+    case 'r': seed = strtoul(optarg, NULL, 10); break;
+    case 'g': if (!write_seeds(optarg)) { perror(optarg); return 1; } return 0;
+    default:
+      fprintf(stderr, "usage: %s [-v] [-n random-inputs] [-r seed] [-g corpus-dir] [file...]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  LLVMFuzzerInitialize(&argc, &argv);
+
+  int status = 0;
+  for (int i = optind; i < argc; i++) {
+    if (!run_path(argv[i])) { perror(argv[i]); status = 1; }
+  }
+
+  srand(seed);
+  for (long n = 0; n < count; n++) {
+    std::vector<uint8_t> data(rand() % 512);
+    for (auto &byte : data) byte = rand();
+    LLVMFuzzerTestOneInput(data.data(), data.size());
+  }
+  return status;
+}
+#endif // FUZZ_STANDALONE
@@ -0,0 +1,481 @@
+/// \file multiboard_sim.cpp
+/// \brief Simulation of several StepperWinch boards synchronized to one host clock.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details This program tests the clock synchronization and time-tagged
+/// commands end to end.  Each board runs the unmodified sketch in its own
+/// child process, since the sketch state is global, with a virtual crystal
+/// which is offset from the host clock and runs fast or slow by a random
+/// number of parts per million.  The host advances all boards in lockstep in
+/// virtual time and models each serial line with its transmission time plus a
+/// random jitter in each direction.
+///
+/// During the synchronization phase the host runs the 'clock' / 'sync'
+/// exchange described in StepperWinch.ino with every board at an interval
+/// which varies by up to an eighth either way, allowing for the transmission
+/// time of each line and reporting the round-trip delay.  It then sends each
+/// board 'at <time> a x <steps>' for a common start time, reads each
+/// disciplined clock directly at that time, and records when each board
+/// issues its first step pulse, measured on the host clock.  One line is
+/// printed per board and a summary:
+///
+///   board <index> <ppm> <offset-usec> <sync-error-usec> <trim-ppb> <clock-error-usec> <start-error-usec>
+///   spread <clock-usec> <start-usec>
+///
+/// The sync error and trim are the last values reported by the board.  The
+/// clock error is the disciplined clock less the host clock at the start
+/// time.  The start error is the first step time less the requested start
+/// time, which includes the time the path takes to accelerate through its
+/// first step.  The spreads are the largest differences between boards.
+///
+/// The exit status is 1 if any board fails to start, if any trim differs
+/// from the one which exactly cancels its crystal error by more than the trim
+/// tolerance, if the clock errors spread by more than the clock tolerance, or
+/// if the start errors spread by more than the clock tolerance plus one main
+/// loop cycle and one step interrupt period, the time by which each board may
+/// quantize the start.  The default tolerances suit the default parameters;
+/// fewer or noisier exchanges need looser ones.
+///
+/// Usage:
+///   multiboard_sim [-n boards] [-p ppm] [-o offset-sec] [-b baud] [-j jitter-usec]
+///                  [-t sync-sec] [-i interval-msec] [-c loop-usec] [-r seed]
+///                  [-T trim-tolerance-ppb] [-C clock-tolerance-usec]
+///
+/// Build from this directory with e.g.:
+///   g++ -std=gnu++11 -O2 -I. -I../../StepperWinch -o multiboard_sim multiboard_sim.cpp Sketch.cpp Arduino.cpp ../../StepperWinch/*.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Arduino.h"
+#include "TimerOne.h"
+#include "../../StepperWinch/cnc_shield.h"
+
+// Entry points from the sketch.
+void setup(void);
+void loop(void);
+
+/// Longest host time advanced per lockstep iteration, in microseconds.  The
+/// boards report the time of each event, so this affects only how promptly
+/// the host replies.
+#define HOST_STEP_USEC 5000
+
+/// Delay between the end of synchronization and the scheduled start.
+#define START_LEAD_USEC 500000
+
+/// Time allowed after the scheduled start for every board to step.
+#define START_TIMEOUT_USEC 2000000
+
+/// Steps in the scheduled move.
+#define START_STEPS 1000
+
+/// Default largest accepted error in the frequency trim of a board, in parts
+/// per billion.
+#define TRIM_TOLERANCE 2000
+
+/// Default largest accepted spread of the disciplined clocks, in microseconds.
+#define CLOCK_TOLERANCE 50
+
+/// Step interrupt period of the sketch, in microseconds.
+#define STEP_PERIOD_USEC 100
+
+//================================================================
+// Board process state.  Each child runs one sketch against a virtual local
+// clock derived from the host time.
+
+/// Virtual local clock of this board.
+static unsigned long virtual_now = 0;
+
+/// Crystal error and clock offset of this board.
+static double board_ppm = 0.0;
+static unsigned long board_offset = 0;
+
+/// True once the first x step has been reported.
+static bool board_stepped = false;
+
+static unsigned long virtual_clock(void) { return virtual_now; }
+
+/// Convert a local clock value to host time.
+static unsigned long host_time(unsigned long local)
+{
+  return (unsigned long) llround((double) (local - board_offset) / (1.0 + 1e-6 * board_ppm));
+}
+
+/// Pin hook reporting the first x step in host time.
+static void board_pin(uint8_t pin, uint8_t level)
+{
+  if (pin == X_AXIS_STEP_PIN && level == HIGH && !board_stepped) {
+    board_stepped = true;
+    printf("S %lu\n", host_time(virtual_now));
+  }
+}
+
+//================================================================
+/// Write each line transmitted by the sketch as 'T <host-usec> <text>' with
+/// the host time at which it was sent.  If probing, a clock reply is instead
+/// written as 'C <host-usec> <usec>'.
+static void board_output(bool probing)
+{
+  size_t newline;
+  unsigned long clock;
+  while ((newline = Serial.tx.find('\n')) != std::string::npos) {
+    std::string line = Serial.tx.substr(0, newline);
+    if (!line.empty() && line[line.size()-1] == '\r') line.erase(line.size()-1);
+    if (probing && sscanf(line.c_str(), "clock %lu", &clock) == 1) printf("C %lu %lu\n", host_time(virtual_now), clock);
+    else printf("T %lu %s\n", host_time(virtual_now), line.c_str());
+    Serial.tx.erase(0, newline + 1);
+  }
+}
+
+/// Main loop of a board process.  Commands arrive on stdin:
+///
+///   line <text>     deliver a line to the sketch serial input
+///   run <usec>      run until the host clock reaches the given time
+///   probe           read the disciplined clock at once
+///
+/// Output lines are written by board_output(), and the first x step as
+/// 'S <host-usec>'.  The end of a run is marked by 'R'.
+static int board_main(double ppm, unsigned long offset, unsigned long loop_usec)
+{
+  board_ppm = ppm;
+  board_offset = offset;
+  virtual_now = offset;
+  native_clock = virtual_clock;
+  native_pin_hook = board_pin;
+  setup();
+
+  unsigned long next_tick = virtual_now + Timer1.period;
+  char *buffer = NULL;
+  size_t size = 0;
+  ssize_t length;
+
+  while ((length = getline(&buffer, &size, stdin)) > 0) {
+    if (buffer[length-1] == '\n') buffer[--length] = 0;
+
+    if (!strncmp(buffer, "line ", 5)) {
+      for (char *c = buffer + 5; *c; c++) Serial.rx.push_back(*c);
+      Serial.rx.push_back('\n');
+
+    } else if (!strcmp(buffer, "probe")) {
+      // Deliver a query with no transit time and run one polling cycle.
+      for (const char *c = "clock\n"; *c; c++) Serial.rx.push_back(*c);
+      loop();
+      board_output(true);
+
+    } else if (!strncmp(buffer, "run ", 4)) {
+      unsigned long host = strtoul(buffer + 4, NULL, 10);
+      unsigned long target = offset + (unsigned long) llround(host * (1.0 + 1e-6 * ppm));
+
+      while ((long) (target - virtual_now) > 0) {
+	loop();
+	board_output(false);
+
+	unsigned long until = virtual_now + loop_usec;
+	while ((long) (until - next_tick) >= 0) {
+	  virtual_now = next_tick;
+	  if (Timer1.handler) Timer1.handler();
+	  next_tick += Timer1.period;
+	}
+	virtual_now = until;
+      }
+      printf("R\n");
+      fflush(stdout);
+    }
+  }
+  free(buffer);
+  return 0;
+}
+
+//================================================================
+// Host side.
+
+/// Host view of one board.
+struct Board {
+  pid_t pid;
+  FILE *to, *from;                 ///< command and reply pipes of the board process
+  double ppm;                      ///< crystal error in parts per million
+  unsigned long offset;            ///< local clock at host time zero
+  std::deque<std::pair<unsigned long, std::string> > inbound;   ///< lines in transit to the board, by arrival time
+  std::deque<std::pair<unsigned long, std::string> > outbound;  ///< lines in transit to the host, by arrival time
+  unsigned long clock_sent;        ///< host time at which the last 'clock' was sent
+  long sync_error, sync_trim;      ///< last 'sync' reply
+  bool probed;
+  long clock_error;                ///< disciplined clock less host clock at the start time
+  bool stepped;
+  unsigned long first_step;        ///< host time of the first x step
+};
+
+/// Serial line model shared by all boards.
+static long line_baud = 115200;
+static unsigned long line_jitter = 50;
+static std::mt19937 generator;
+
+/// Return the time taken to transmit a line and its terminator.
+static unsigned long transmission(const std::string &line)
+{
+  return (unsigned long) ((line.size() + 1) * 10.0e6 / line_baud);
+}
+
+/// Return the arrival time of a line sent at the given time, which follows any
+/// line still in transit on the same link.
+static unsigned long arrival(const std::deque<std::pair<unsigned long, std::string> > &link,
+			     unsigned long now, const std::string &line)
+{
+  unsigned long start = link.empty() ? now : std::max(now, link.back().first);
+  std::uniform_int_distribution<unsigned long> jitter(0, line_jitter);
+  return start + transmission(line) + jitter(generator);
+}
+
+static void send_line(Board &b, unsigned long now, const std::string &line)
+{
+  b.inbound.push_back(std::make_pair(arrival(b.inbound, now, line), line));
+}
+
+/// Start a board process.  Returns false on error.
+static bool spawn(Board &b, unsigned long loop_usec)
+{
+  int down[2], up[2];
+  if (pipe(down) < 0 || pipe(up) < 0) return false;
+
+  fflush(stdout);
+  b.pid = fork();
+  if (b.pid < 0) return false;
+  if (b.pid == 0) {
+    dup2(down[0], STDIN_FILENO);
+    dup2(up[1], STDOUT_FILENO);
+    close(down[0]); close(down[1]); close(up[0]); close(up[1]);
+    exit(board_main(b.ppm, b.offset, loop_usec));
+  }
+  close(down[0]);
+  close(up[1]);
+  b.to = fdopen(down[1], "w");
+  b.from = fdopen(up[0], "r");
+  return b.to && b.from;
+}
+
+/// Start a board running up to the given host time, then deliver the lines
+/// which reach it by that time; they are read on the following run.
+static void advance(Board &b, unsigned long now)
+{
+  fprintf(b.to, "run %lu\n", now);
+  while (!b.inbound.empty() && (long) (now - b.inbound.front().first) >= 0) {
+    fprintf(b.to, "line %s\n", b.inbound.front().second.c_str());
+    b.inbound.pop_front();
+  }
+  fflush(b.to);
+}
+
+/// Collect the output of a board once it has run up to the given host time,
+/// and answer the replies which have reached the host.  Returns false if the
+/// board process has failed.
+static bool collect(Board &b, unsigned long now)
+{
+  char *buffer = NULL;
+  size_t size = 0;
+  ssize_t length;
+  bool ready = false;
+  while (!ready && (length = getline(&buffer, &size, b.from)) > 0) {
+    if (buffer[length-1] == '\n') buffer[--length] = 0;
+    if (!strcmp(buffer, "R")) ready = true;
+    else if (buffer[0] == 'S') {
+      b.stepped = true;
+      b.first_step = strtoul(buffer + 2, NULL, 10);
+    } else if (buffer[0] == 'C') {
+      unsigned long host, clock;
+      if (sscanf(buffer + 2, "%lu %lu", &host, &clock) == 2) {
+	b.probed = true;
+	b.clock_error = (long) (clock - host);
+      }
+    } else if (buffer[0] == 'T') {
+      char *text;
+      unsigned long sent = strtoul(buffer + 2, &text, 10);
+      std::string line(text + 1);
+      unsigned long arrives = arrival(b.outbound, sent, line);
+      if (line.compare(0, 6, "txyza ")) b.outbound.push_back(std::make_pair(arrives, line));
+    }
+  }
+  free(buffer);
+  if (!ready) return false;
+
+  // Handle the replies which have reached the host, each at its arrival time.
+  while (!b.outbound.empty() && (long) (now - b.outbound.front().first) >= 0) {
+    unsigned long received = b.outbound.front().first;
+    std::string line = b.outbound.front().second;
+    b.outbound.pop_front();
+    unsigned long board_time;
+    long error, trim;
+    if (sscanf(line.c_str(), "clock %lu", &board_time) == 1) {
+      // The board read its clock once the query had arrived, taken to be
+      // midway through the round trip less the transmission times.
+      unsigned long query = transmission("clock"), reply = transmission(line);
+      unsigned long round_trip = received - b.clock_sent;
+      unsigned long delay = (round_trip > query + reply) ? round_trip - query - reply : 0;
+      unsigned long host = b.clock_sent + query + delay / 2;
+      send_line(b, received, "sync " + std::to_string(board_time) + " " + std::to_string(host) + " " + std::to_string(delay));
+    } else if (sscanf(line.c_str(), "sync %ld %ld", &error, &trim) == 2) {
+      b.sync_error = error;
+      b.sync_trim = trim;
+    }
+  }
+  return true;
+}
+
+//================================================================
+int main(int argc, char **argv)
+{
+  int count = 4;
+  double max_ppm = 50.0, max_offset = 5.0, sync_time = 30.0;
+  unsigned long interval_ms = 250, loop_usec = 200;
+  unsigned seed = 1;
+  long trim_tolerance = TRIM_TOLERANCE, clock_tolerance = CLOCK_TOLERANCE;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:p:o:b:j:t:i:c:r:T:C:")) != -1) {
+    switch (opt) {
+    case 'n': count = atoi(optarg); break;
+    case 'p': max_ppm = atof(optarg); break;
+    case 'o': max_offset = atof(optarg); break;
+    case 'b': line_baud = atol(optarg); break;
+    case 'j': line_jitter = strtoul(optarg, NULL, 10); break;
+    case 't': sync_time = atof(optarg); break;
+    case 'i': interval_ms = strtoul(optarg, NULL, 10); break;
+    case 'c': loop_usec = strtoul(optarg, NULL, 10); break;
+    case 'r': seed = strtoul(optarg, NULL, 10); break;
+    case 'T': trim_tolerance = atol(optarg); break;
+    case 'C': clock_tolerance = atol(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-n boards] [-p ppm] [-o offset-sec] [-b baud] [-j jitter-usec] "
+	      "[-t sync-sec] [-i interval-msec] [-c loop-usec] [-r seed] "
+	      "[-T trim-tolerance-ppb] [-C clock-tolerance-usec]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (count < 1 || line_baud <= 0 || interval_ms == 0) return 1;
+  if (loop_usec == 0) loop_usec = 1;
+
+  generator.seed(seed);
+  std::uniform_real_distribution<double> ppm(-max_ppm, max_ppm);
+  std::uniform_real_distribution<double> offset(0.0, max_offset * 1e6);
+
+  std::vector<Board> boards(count);
+  for (Board &b : boards) {
+    b.ppm = ppm(generator);
+    b.offset = (unsigned long) offset(generator);
+    b.clock_sent = 0;
+    b.sync_error = b.sync_trim = 0;
+    b.probed = false;
+    b.clock_error = 0;
+    b.stepped = false;
+    b.first_step = 0;
+    if (!spawn(b, loop_usec)) { perror("spawn"); return 1; }
+    send_line(b, 0, "enable 1");
+  }
+
+  // Synchronization phase, followed by a common scheduled start.
+  unsigned long sync_end = (unsigned long) (sync_time * 1e6);
+  unsigned long start = sync_end + START_LEAD_USEC;
+  unsigned long next_sync = 0, sync_period = interval_ms * 1000;
+  std::uniform_int_distribution<unsigned long> sync_jitter(0, sync_period / 4);
+  bool failed = false;
+
+  // Each iteration runs every board up to the next event: a line arriving at
+  // a board, a scheduled transmission, or the longest host step.
+  unsigned long now = 0;
+  while (!failed && now < start + START_TIMEOUT_USEC) {
+    if (now < sync_end && now == next_sync) {
+      for (Board &b : boards) {
+	b.clock_sent = now;
+	send_line(b, now, "clock");
+      }
+      // A host under a general-purpose operating system does not start the
+      // exchanges at exact intervals, so they do not alias with the polling
+      // loop of the boards.
+      next_sync += sync_period - sync_period / 8 + sync_jitter(generator);
+    }
+    if (now == sync_end) {
+      for (Board &b : boards) send_line(b, now, "at " + std::to_string(start) + " a x " + std::to_string(START_STEPS));
+    }
+    if (now == start) {
+      for (Board &b : boards) fprintf(b.to, "probe\n");
+    }
+
+    unsigned long next = now + HOST_STEP_USEC;
+    if (now < sync_end) next = std::min(next, std::min(next_sync, sync_end));
+    if (now < start) next = std::min(next, start);
+    for (Board &b : boards) {
+      if (!b.inbound.empty()) next = std::min(next, std::max(now + 1, b.inbound.front().first));
+    }
+    now = next;
+
+    for (Board &b : boards) advance(b, now);
+    bool all_stepped = true;
+    for (Board &b : boards) {
+      if (!collect(b, now)) failed = true;
+      all_stepped &= b.stepped;
+    }
+    if (all_stepped) break;
+  }
+
+  long lowest = 0, highest = 0, clock_lowest = 0, clock_highest = 0;
+  bool first = true;
+  for (size_t i = 0; i < boards.size(); i++) {
+    Board &b = boards[i];
+    long error = (long) (b.first_step - start);
+    printf("board %zu %.1f %lu %ld %ld ", i, b.ppm, b.offset, b.sync_error, b.sync_trim);
+    if (b.probed) printf("%ld ", b.clock_error);
+    else printf("none ");
+    if (b.stepped) printf("%ld\n", error);
+    else printf("none\n");
+
+    // A board running fast by some ppm needs a trim which scales its clock
+    // back to the host rate.
+    long trim_error = labs(b.sync_trim - lround(1e9 * (1.0 / (1.0 + 1e-6 * b.ppm) - 1.0)));
+    if (trim_error > trim_tolerance) {
+      fprintf(stderr, "board %zu: trim off by %ld ppb\n", i, trim_error);
+      failed = true;
+    }
+    if (!b.stepped || !b.probed) { failed = true; continue; }
+    if (first || error < lowest) lowest = error;
+    if (first || error > highest) highest = error;
+    if (first || b.clock_error < clock_lowest) clock_lowest = b.clock_error;
+    if (first || b.clock_error > clock_highest) clock_highest = b.clock_error;
+    first = false;
+  }
+  if (!first) {
+    printf("spread %ld %ld\n", clock_highest - clock_lowest, highest - lowest);
+    long start_tolerance = clock_tolerance + loop_usec + STEP_PERIOD_USEC;
+    if (clock_highest - clock_lowest > clock_tolerance) {
+      fprintf(stderr, "clock spread exceeds %ld usec\n", clock_tolerance);
+      failed = true;
+    }
+    if (highest - lowest > start_tolerance) {
+      fprintf(stderr, "start spread exceeds %ld usec\n", start_tolerance);
+      failed = true;
+    }
+  }
+
+  // Each board process holds the pipes of those started before it, so all
+  // must be closed before any will exit.
+  for (Board &b : boards) fclose(b.to);
+  for (Board &b : boards) {
+    waitpid(b.pid, NULL, 0);
+    fclose(b.from);
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+/// \file settle_test.cpp
+/// \brief Regression test of settling events for velocity commands.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details This program runs the sketch in virtual time and checks that
+/// every command is answered by its 'done' event: a position move, a velocity
+/// command brought to a stop with 'v <axis> 0', and a velocity command which
+/// brakes against a soft limit.  It also checks that a velocity command still
+/// running at speed is not reported as settled.  Each check prints one line;
+/// the exit status is 0 if all passed.
+///
+/// Build from this directory with e.g.:
+///   g++ -std=gnu++11 -O2 -I. -I../../StepperWinch -o settle_test settle_test.cpp Arduino.cpp ../../StepperWinch/*.cpp
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+// The sketch is compiled into this file so that it can be run in virtual time.
+#include "Sketch.cpp"
+
+/// Virtual time in microseconds.
+static unsigned long virtual_now = 0;
+static unsigned long virtual_clock(void) { return virtual_now; }
+
+/// Replies of the sketch not yet examined.
+static std::string replies;
+
+/// Number of checks failed.
+static int failures = 0;
+
+//================================================================
+static void check(bool passed, const char *name)
+{
+  printf("%s %s\n", passed ? "pass" : "FAIL", name);
+  if (!passed) failures++;
+}
+
+/// Run the sketch for the given time, with the timer handler at its period,
+/// collecting its replies.
+static void advance(unsigned long usec)
+{
+  unsigned long until = virtual_now + usec;
+  while ((long) (until - virtual_now) > 0) {
+    loop();
+    for (unsigned long tick = 0; tick < 10 && (long) (until - virtual_now) > 0; tick++) {
+      virtual_now += Timer1.period;
+      if (Timer1.handler) Timer1.handler();
+    }
+  }
+  replies += Serial.tx;
+  Serial.tx.clear();
+}
+
+/// Deliver one command line and run until it has been consumed.
+static void command(const char *line)
+{
+  for (const char *c = line; *c; c++) Serial.rx.push_back(*c);
+  Serial.rx.push_back('\n');
+  while (!Serial.rx.empty()) advance(1000);
+}
+
+/// Run for up to the given time until a 'done' message arrives for the axis.
+/// Returns true if one did, storing its step position.
+static bool wait_done(char axis, double seconds, long *position)
+{
+  char prefix[8];
+  snprintf(prefix, sizeof(prefix), "done %c ", axis);
+  for (double t = 0.0; t < seconds; t += 0.001) {
+    advance(1000);
+    size_t start = replies.find(prefix);
+    if (start != std::string::npos) {
+      *position = atol(replies.c_str() + start + strlen(prefix));
+      replies.erase(0, start + strlen(prefix));
+      return true;
+    }
+  }
+  return false;
+}
+
+//================================================================
+int main(int argc, char **argv)
+{
+  native_clock = virtual_clock;
+  setup();
+  advance(100000);
+  replies.clear();
+
+  long position = 0;
+  command("settle xy 2 20 100");
+
+  command("a y 50");
+  check(wait_done('y', 3.0, &position) && labs(position - 50) <= 2, "position move settles at its target");
+
+  command("v x 200");
+  check(!wait_done('x', 0.5, &position), "velocity command at speed does not settle");
+
+  command("v x 0");
+  check(wait_done('x', 2.0, &position), "velocity command stopped with zero velocity settles");
+
+  command("limit x -1000 300");
+  command("v x 200");
+  check(wait_done('x', 5.0, &position) && labs(position - 300) <= 2, "velocity command braking at a soft limit settles");
+
+  return failures ? 1 : 0;
+}
+//================================================================
@@ -0,0 +1,302 @@
+/// \file winch_native.cpp
+/// \brief Native host build of the StepperWinch firmware with record and replay.
+///
+/// \copyright Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+/// possible under law, the author has dedicated all copyright and related and
+/// neighboring rights to this software to the public domain worldwide.  This
+/// software is distributed without any warranty.  You should have received a
+/// copy of the CC0 Public Domain Dedication along with this software.  If not,
+/// see <http://creativecommons.org/publicdomain/zero/1.0/>.
+///
+/// \details This program runs the unmodified sketch on a host in one of two
+/// modes.  In live mode the sketch runs in real time on a new pseudo-terminal
+/// (or stdin/stdout), so host software can talk to it as to a board; every
+/// input line may be recorded with its arrival micros() value to a session
+/// file.  In replay mode a session file is fed back through the same sketch in
+/// virtual time, as fast as the host allows, and the resulting step and
+/// message trace is printed for diffing across firmware versions:
+///
+///   S <usec> <axis> <position>    a step pulse, with the position counted from the step and direction pins
+///   T <usec> <text>               a line transmitted by the firmware
+///   P <usec> <pin> <level>        any output pin change (with -v)
+///   V <usec> <axis> <rule> <usec> a step timing violation and the measured interval (with -k)
+///
+/// With -k the step and direction outputs are checked against the A4988
+/// minimum timing: step high and low for 1 usec (rules 'high' and 'low'), and
+/// direction stable 0.2 usec before and after each rising step edge ('setup'
+/// and 'hold').  Pin writes within one interrupt share a timestamp in virtual
+/// time, so any pair of edges not separated by a poll shows as a violation.
+/// The number of violations is printed on stderr and the exit status is 2 if
+/// there were any.
+///
+/// Usage:
+///   winch_native [-s] [-r session.swr]
+///   winch_native -p session.swr [-c loop-usec] [-e tail-usec] [-v] [-k]
+///
+/// Build from this directory with e.g.:
+///   g++ -std=gnu++11 -O2 -I. -I../../StepperWinch -o winch_native winch_native.cpp Sketch.cpp Arduino.cpp Session.cpp ../../StepperWinch/*.cpp -lutil
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "Arduino.h"
+#include "TimerOne.h"
+#include "Session.h"
+#include "../../StepperWinch/cnc_shield.h"
+
+// Entry points from the sketch.
+void setup(void);
+void loop(void);
+
+/// Virtual clock for replay mode.
+static unsigned long virtual_now = 0;
+
+/// Per-axis position reconstructed from the output pins.
+static long pin_position[4];
+
+/// True to print every output pin change.
+static bool verbose = false;
+
+/// True to check the step and direction timing.
+static bool check_timing = false;
+
+/// A4988 minimum step and direction timing in nanoseconds.
+#define STEP_HIGH_NS  1000
+#define STEP_LOW_NS   1000
+#define DIR_SETUP_NS  200
+#define DIR_HOLD_NS   200
+
+/// Time of the last step edge, last rising step edge and last direction
+/// change of each axis, and whether each has occurred.
+static unsigned long step_edge[4], step_rise[4], dir_edge[4];
+static bool step_seen[4], rise_seen[4], dir_seen[4];
+
+/// Number of step timing violations found.
+static long timing_violations = 0;
+
+//================================================================
+static unsigned long virtual_clock(void) { return virtual_now; }
+
+static unsigned long real_clock(void)
+{
+  static struct timespec start;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  if (start.tv_sec == 0 && start.tv_nsec == 0) start = ts;
+  return (unsigned long) ((ts.tv_sec - start.tv_sec) * 1000000L + (ts.tv_nsec - start.tv_nsec) / 1000);
+}
+
+//================================================================
+/// Report a violation if the interval since an earlier edge is too short.
+static void check_interval(bool seen, unsigned long since, unsigned long min_ns, char axis, const char *rule)
+{
+  unsigned long interval = micros() - since;
+  if (seen && interval * 1000 < min_ns) {
+    printf("V %lu %c %s %lu\n", micros(), axis, rule, interval);
+    timing_violations++;
+  }
+}
+
+//================================================================
+/// Pin hook which checks the step and direction timing of one axis.
+static void check_pin(int i, bool is_step, uint8_t level, char axis)
+{
+  unsigned long now = micros();
+  if (is_step) {
+    check_interval(step_seen[i], step_edge[i], level ? STEP_LOW_NS : STEP_HIGH_NS, axis, level ? "low" : "high");
+    if (level) {
+      check_interval(dir_seen[i], dir_edge[i], DIR_SETUP_NS, axis, "setup");
+      step_rise[i] = now;
+      rise_seen[i] = true;
+    }
+    step_edge[i] = now;
+    step_seen[i] = true;
+  } else {
+    check_interval(rise_seen[i], step_rise[i], DIR_HOLD_NS, axis, "hold");
+    dir_edge[i] = now;
+    dir_seen[i] = true;
+  }
+}
+
+//================================================================
+/// Pin hook which reconstructs each axis position from the step and direction
+/// outputs the way a driver would.
+static void trace_pin(uint8_t pin, uint8_t level)
+{
+  static const uint8_t step_pins[4] = { X_AXIS_STEP_PIN, Y_AXIS_STEP_PIN, Z_AXIS_STEP_PIN, A_AXIS_STEP_PIN };
+  static const uint8_t dir_pins[4]  = { X_AXIS_DIR_PIN,  Y_AXIS_DIR_PIN,  Z_AXIS_DIR_PIN,  A_AXIS_DIR_PIN };
+  static const char axes[] = "xyza";
+
+  if (verbose) printf("P %lu %d %d\n", micros(), pin, level);
+
+  for (int i = 0; i < 4; i++) {
+    if (check_timing && (pin == step_pins[i] || pin == dir_pins[i])) check_pin(i, pin == step_pins[i], level, axes[i]);
+    if (pin == step_pins[i] && level == HIGH) {
+      pin_position[i] += native_pin_level[dir_pins[i]] ? 1 : -1;
+      printf("S %lu %c %ld\n", micros(), axes[i], pin_position[i]);
+    }
+  }
+}
+
+//================================================================
+/// Remove complete lines from the sketch output, passing each to the callback.
+template<class F> static void drain_output(F emit)
+{
+  size_t newline;
+  while ((newline = Serial.tx.find('\n')) != std::string::npos) {
+    std::string line = Serial.tx.substr(0, newline);
+    if (!line.empty() && line[line.size()-1] == '\r') line.erase(line.size()-1);
+    emit(line);
+    Serial.tx.erase(0, newline + 1);
+  }
+}
+
+//================================================================
+/// Run the sketch in virtual time over a recorded session.
+static int replay(const char *path, unsigned long loop_usec, unsigned long tail_usec)
+{
+  SessionReader reader;
+  if (!reader.open(path)) { fprintf(stderr, "cannot read session %s\n", path); return 1; }
+
+  native_clock = virtual_clock;
+  native_pin_hook = trace_pin;
+  setup();
+
+  unsigned long next_tick = Timer1.period;
+  unsigned long record_usec;
+  std::string record_line;
+  bool pending = reader.read(&record_usec, &record_line);
+  unsigned long end_usec = pending ? 0 : tail_usec;
+
+  for (;;) {
+    // Deliver each recorded line at its original arrival time.
+    while (pending && record_usec <= virtual_now) {
+      for (char c : record_line) Serial.rx.push_back(c);
+      Serial.rx.push_back('\n');
+      end_usec = record_usec + tail_usec;
+      pending = reader.read(&record_usec, &record_line);
+    }
+    if (!pending && (long) (virtual_now - end_usec) >= 0) break;
+
+    loop();
+
+    // Advance the clock by the modeled loop duration, running the timer
+    // interrupt at each period boundary passed.
+    unsigned long until = virtual_now + loop_usec;
+    while ((long) (until - next_tick) >= 0) {
+      virtual_now = next_tick;
+      if (Timer1.handler) Timer1.handler();
+      next_tick += Timer1.period;
+    }
+    virtual_now = until;
+
+    drain_output([](const std::string &line) { printf("T %lu %s\n", virtual_now, line.c_str()); });
+  }
+
+  if (check_timing) {
+    fprintf(stderr, "%ld step timing violations\n", timing_violations);
+    if (timing_violations > 0) return 2;
+  }
+  return 0;
+}
+
+//================================================================
+/// Run the sketch in real time on a pseudo-terminal or stdin/stdout.
+static int live(bool use_stdio, const char *record_path)
+{
+  int in_fd = STDIN_FILENO, out_fd = STDOUT_FILENO;
+
+  if (!use_stdio) {
+    int slave;
+    char name[64];
+    if (openpty(&in_fd, &slave, name, NULL, NULL) < 0) { perror("openpty"); return 1; }
+    struct termios tio;
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    out_fd = in_fd;
+    fprintf(stderr, "%s\n", name);
+  }
+  fcntl(in_fd, F_SETFL, fcntl(in_fd, F_GETFL) | O_NONBLOCK);
+
+  SessionWriter writer;
+  if (record_path && !writer.open(record_path)) { fprintf(stderr, "cannot write session %s\n", record_path); return 1; }
+
+  native_clock = real_clock;
+  setup();
+
+  unsigned long next_tick = micros() + Timer1.period;
+  std::string partial;
+
+  for (;;) {
+    char buffer[256];
+    ssize_t count = read(in_fd, buffer, sizeof(buffer));
+    if (count == 0 && use_stdio) break;
+    for (ssize_t i = 0; i < count; i++) {
+      Serial.rx.push_back(buffer[i]);
+      if (buffer[i] == '\n' || buffer[i] == '\r') {
+	if (!partial.empty()) writer.write(micros(), partial);
+	partial.clear();
+      } else partial += buffer[i];
+    }
+
+    loop();
+
+    unsigned long now = micros();
+    while ((long) (now - next_tick) >= 0) {
+      if (Timer1.handler) Timer1.handler();
+      next_tick += Timer1.period;
+    }
+
+    if (!Serial.tx.empty()) {
+      ssize_t written = write(out_fd, Serial.tx.data(), Serial.tx.size());
+      if (written > 0) Serial.tx.erase(0, written);
+    }
+
+    // Yield briefly when idle rather than spinning a full core.
+    if (count <= 0) {
+      struct pollfd pfd = { in_fd, POLLIN, 0 };
+      poll(&pfd, 1, 0);
+      usleep(20);
+    }
+  }
+  return 0;
+}
+
+//================================================================
+int main(int argc, char **argv)
+{
+  const char *record_path = NULL, *replay_path = NULL;
+  unsigned long loop_usec = 200, tail_usec = 2000000;
+  bool use_stdio = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "sr:p:c:e:vk")) != -1) {
+    switch (opt) {
+    case 's': use_stdio = true; break;
+    case 'r': record_path = optarg; break;
+    case 'p': replay_path = optarg; break;
+    case 'c': loop_usec = strtoul(optarg, NULL, 10); break;
+    case 'e': tail_usec = strtoul(optarg, NULL, 10); break;
+    case 'v': verbose = true; break;
+    case 'k': check_timing = true; break;
+    default:
+      fprintf(stderr, "usage: %s [-s] [-r session] | -p session [-c loop-usec] [-e tail-usec] [-v] [-k]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (loop_usec == 0) loop_usec = 1;
+
+  if (replay_path) return replay(replay_path, loop_usec, tail_usec);
+  else return live(use_stdio, record_path);
+}
+//================================================================
@@ -0,0 +1,55 @@
+#!/bin/sh
+# ram_report.sh : per-module static RAM report for the StepperWinch sketch.
+#
+# Copyright: Written 2018 by Garth Zeglin <garthz@cmu.edu>.  To the extent
+# possible under law, the author has dedicated all copyright and related and
+# neighboring rights to this software to the public domain worldwide.  This
+# software is distributed without any warranty.  You should have received a
+# copy of the CC0 Public Domain Dedication along with this software.  If not,
+# see <http://creativecommons.org/publicdomain/zero/1.0/>.
+#
+# Compiles the sketch for an Uno with arduino-cli, then lists the initialized
+# (.data) and zeroed (.bss) RAM of each sketch object file, the Arduino core
+# (serial buffers, timer state) as a whole, and the largest RAM symbols.  The
+# stack and heap share whatever remains of the RAM bytes (default 2048), which
+# must be at least HEADROOM bytes (default 400) or the exit status is 1.
+#
+# The board's default build profile is measured unless LEAN is set to 0 or 1,
+# e.g. LEAN=0 to see how far the full profile overflows an Uno.
+#
+# Usage (from the repository root):
+#   [LEAN=0|1] [RAM=bytes] [HEADROOM=bytes] host/ram_report.sh [fqbn] [build-dir]
+
+FQBN=${1:-arduino:avr:uno}
+BUILD=${2:-/tmp/StepperWinch-ram}
+RAM=${RAM:-2048}
+HEADROOM=${HEADROOM:-400}
+
+if [ -n "$LEAN" ]; then
+  set -- --build-property "compiler.cpp.extra_flags=-DLEAN_BUILD=$LEAN"
+else
+  set --
+fi
+
+arduino-cli compile --fqbn "$FQBN" --build-path "$BUILD" "$@" StepperWinch >/dev/null || exit 1
+
+echo "module                            data    bss  total"
+for obj in "$BUILD"/sketch/*.o "$BUILD"/core/core.a; do
+  avr-size "$obj" | awk -v name="$(basename "$obj" .o)" '
+    NR > 1 { data += $2; bss += $3 }
+    END    { printf "%-30s %7d %6d %6d\n", name, data, bss, data + bss }'
+done
+
+echo
+avr-size -C --mcu=atmega328p "$BUILD"/StepperWinch.ino.elf | grep -E 'Program|Data'
+
+echo
+echo "largest RAM symbols:"
+avr-nm -C -S --size-sort -t d "$BUILD"/StepperWinch.ino.elf | awk '$3 ~ /^[bBdD]$/' | tail -20
+
+# Static RAM is the sum of the data and bss columns of the Berkeley format.
+STATIC=$(avr-size "$BUILD"/StepperWinch.ino.elf | awk 'NR == 2 { print $2 + $3 }')
+FREE=$((RAM - STATIC))
+echo
+echo "static RAM $STATIC bytes, $FREE bytes free for stack and heap (need $HEADROOM)"
+[ "$FREE" -ge "$HEADROOM" ]